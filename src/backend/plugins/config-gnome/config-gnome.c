@@ -54,6 +54,14 @@ enum {
   PROP_CONFIG_OPTION
 };
 
+static void
+on_settings_changed (GSettings  *settings,
+                     const char *key,
+                     gpointer    user_data)
+{
+  g_signal_emit_by_name (user_data, "changed");
+}
+
 static void
 px_config_gnome_init (PxConfigGnome *self)
 {
@@ -91,6 +99,12 @@ px_config_gnome_init (PxConfigGnome *self)
   self->https_proxy_settings = g_settings_new ("org.gnome.system.proxy.https");
   self->ftp_proxy_settings = g_settings_new ("org.gnome.system.proxy.ftp");
   self->socks_proxy_settings = g_settings_new ("org.gnome.system.proxy.socks");
+
+  g_signal_connect_object (self->proxy_settings, "changed", G_CALLBACK (on_settings_changed), self, 0);
+  g_signal_connect_object (self->http_proxy_settings, "changed", G_CALLBACK (on_settings_changed), self, 0);
+  g_signal_connect_object (self->https_proxy_settings, "changed", G_CALLBACK (on_settings_changed), self, 0);
+  g_signal_connect_object (self->ftp_proxy_settings, "changed", G_CALLBACK (on_settings_changed), self, 0);
+  g_signal_connect_object (self->socks_proxy_settings, "changed", G_CALLBACK (on_settings_changed), self, 0);
 }
 
 static void
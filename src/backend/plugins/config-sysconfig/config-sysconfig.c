@@ -66,6 +66,7 @@ on_file_changed (GFileMonitor      *monitor,
 
   g_debug ("%s: Reloading configuration", __FUNCTION__);
   px_config_sysconfig_set_config_file (self, g_file_get_path (file));
+  g_signal_emit_by_name (self, "changed");
 }
 
 static
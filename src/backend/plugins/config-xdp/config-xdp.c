@@ -159,5 +159,7 @@ px_config_iface_init (PxConfigInterface *iface)
 {
   iface->name = "config-xdp";
   iface->priority = PX_CONFIG_PRIORITY_DEFAULT;
+  /* The portal gets the whole url */
+  iface->needs_full_url = TRUE;
   iface->get_config = px_config_xdp_get_config;
 }
@@ -0,0 +1,500 @@
+/* pacrunner-duktape-analysis.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <string.h>
+
+#include "pacrunner-duktape-analysis.h"
+
+/*
+ * A conservative dependency analysis of PAC files, working on tokens
+ * rather than a syntax tree:
+ *
+ * - The url parameter of FindProxyForURL() must not be mentioned anywhere
+ *   else, by name or through `arguments`.
+ * - Time and DNS dependencies are found by the names of the helpers and
+ *   built-ins which introduce them.
+ * - Assignments inside functions to top level variables, or to variables
+ *   which are not declared anywhere, count as state kept across calls, as
+ *   does Math.random().
+ *
+ * Anything the tokenizer does not understand, and constructs like eval()
+ * which defeat the analysis, make the PAC depend on everything.
+ */
+
+static const char *punctuators[] = {
+  ">>>=", "===", "!==", ">>>", "<<=", ">>=",
+  "==", "!=", "<=", ">=", "&&", "||", "++", "--",
+  "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<", ">>",
+  NULL
+};
+
+static const char *assignments[] = {
+  "=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", ">>>=", "&=", "|=", "^=", "++", "--", NULL
+};
+
+/* Keywords after which a '/' starts a regular expression */
+static const char *regex_keywords[] = {
+  "return", "typeof", "instanceof", "in", "new", "delete", "void", "throw", "case", "do", "else", NULL
+};
+
+static const char *declaration_keywords[] = { "var", "let", "const", NULL };
+
+static const char *time_names[] = { "weekdayRange", "dateRange", "timeRange", NULL };
+
+static const char *dns_names[] = {
+  "dnsResolve", "dnsResolveEx", "isResolvable", "isResolvableEx", "isInNet", "isInNetEx",
+  "myIpAddress", "myIpAddressEx", NULL
+};
+
+/* Names which give access to code or variables the analysis cannot follow */
+/* Methods which modify the object they are called on, or their arguments */
+static const char *mutating_names[] = {
+  "push", "pop", "shift", "unshift", "splice", "sort", "reverse", "fill", "copyWithin",
+  "set", "add", "delete", "clear", "assign", "defineProperty", "defineProperties",
+  "setPrototypeOf", NULL
+};
+
+static const char *opaque_names[] = {
+  "arguments", "eval", "Function", "caller", "callee", "with", "this", "globalThis", "Duktape", NULL
+};
+
+gboolean
+px_js_token_is (PxJsToken  *token,
+                const char *str)
+{
+  return token && token->len == strlen (str) && strncmp (token->start, str, token->len) == 0;
+}
+
+gboolean
+px_js_token_is_one_of (PxJsToken   *token,
+                       const char **strs)
+{
+  for (guint idx = 0; strs[idx]; idx++) {
+    if (px_js_token_is (token, strs[idx]))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+px_js_token_equal (PxJsToken *a,
+                   PxJsToken *b)
+{
+  return a->len == b->len && strncmp (a->start, b->start, a->len) == 0;
+}
+
+static gboolean
+px_js_is_identifier_char (char c,
+                          gboolean first)
+{
+  if (g_ascii_isalpha (c) || c == '_' || c == '$' || (guchar)c >= 0x80)
+    return TRUE;
+
+  return !first && g_ascii_isdigit (c);
+}
+
+/* Whether a '/' following @prev starts a regular expression */
+static gboolean
+px_js_regex_allowed (PxJsToken *prev)
+{
+  if (!prev)
+    return TRUE;
+
+  if (prev->type == PX_JS_LITERAL)
+    return FALSE;
+
+  if (prev->type == PX_JS_IDENTIFIER)
+    return px_js_token_is_one_of (prev, regex_keywords);
+
+  return !px_js_token_is (prev, ")") && !px_js_token_is (prev, "]");
+}
+
+/* Returns the length of the string or regular expression at @p, or 0 */
+static gsize
+px_js_scan_quoted (const char *p,
+                   const char *end,
+                   char        quote)
+{
+  const char *start = p;
+  gboolean in_class = FALSE;
+
+  for (p++; p < end; p++) {
+    if (*p == '\n' || *p == '\r')
+      return 0;
+
+    if (*p == '\\') {
+      p++;
+      continue;
+    }
+
+    /* A '/' in a character class does not end a regular expression */
+    if (quote == '/' && *p == '[')
+      in_class = TRUE;
+    else if (quote == '/' && *p == ']')
+      in_class = FALSE;
+    else if (*p == quote && !in_class)
+      return p - start + 1;
+  }
+
+  return 0;
+}
+
+/**
+ * px_js_tokenize:
+ * @source: JavaScript source
+ * @len: length of @source
+ * @tokens: array of `PxJsToken` to append to
+ *
+ * Split @source into tokens pointing into it. Only the subset of
+ * JavaScript found in PAC files is supported.
+ *
+ * Returns: %FALSE if @source could not be tokenized
+ */
+gboolean
+px_js_tokenize (const char *source,
+                gsize       len,
+                GArray     *tokens)
+{
+  const char *p = source;
+  const char *end = source + len;
+  guint depth = 0;
+
+  while (p < end) {
+    PxJsToken *prev = tokens->len > 0 ? &g_array_index (tokens, PxJsToken, tokens->len - 1) : NULL;
+    PxJsToken token = { PX_JS_PUNCTUATOR, p, 1, depth };
+
+    if (g_ascii_isspace (*p)) {
+      p++;
+      continue;
+    }
+
+    if (p + 1 < end && p[0] == '/' && p[1] == '/') {
+      while (p < end && *p != '\n')
+        p++;
+      continue;
+    }
+
+    if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+      const char *comment_end = g_strstr_len (p + 2, end - p - 2, "*/");
+
+      if (!comment_end)
+        return FALSE;
+      p = comment_end + 2;
+      continue;
+    }
+
+    if (px_js_is_identifier_char (*p, TRUE)) {
+      token.type = PX_JS_IDENTIFIER;
+      while (p + token.len < end && px_js_is_identifier_char (p[token.len], FALSE))
+        token.len++;
+    } else if (g_ascii_isdigit (*p) || (*p == '.' && p + 1 < end && g_ascii_isdigit (p[1]))) {
+      token.type = PX_JS_LITERAL;
+      while (p + token.len < end && (g_ascii_isalnum (p[token.len]) || p[token.len] == '.' ||
+                                     ((p[token.len] == '+' || p[token.len] == '-') &&
+                                      (p[token.len - 1] == 'e' || p[token.len - 1] == 'E'))))
+        token.len++;
+    } else if (*p == '"' || *p == '\'' || (*p == '/' && px_js_regex_allowed (prev))) {
+      token.type = PX_JS_LITERAL;
+      token.len = px_js_scan_quoted (p, end, *p);
+      if (token.len == 0)
+        return FALSE;
+
+      /* Regular expression flags */
+      while (*p == '/' && p + token.len < end && px_js_is_identifier_char (p[token.len], FALSE))
+        token.len++;
+    } else if (*p == '`' || *p == '\\') {
+      /* Template literals and escaped identifiers */
+      return FALSE;
+    } else {
+      for (guint idx = 0; punctuators[idx]; idx++) {
+        gsize punctuator_len = strlen (punctuators[idx]);
+
+        if ((gsize)(end - p) >= punctuator_len && strncmp (p, punctuators[idx], punctuator_len) == 0) {
+          token.len = punctuator_len;
+          break;
+        }
+      }
+
+      if (*p == '{') {
+        depth++;
+      } else if (*p == '}') {
+        if (depth == 0)
+          return FALSE;
+        token.depth = --depth;
+      }
+    }
+
+    g_array_append_val (tokens, token);
+    p += token.len;
+  }
+
+  return depth == 0;
+}
+
+/*
+ * Add the names declared by the tokens to @declared: variables, functions
+ * and parameters. Names declared at the top level also go to @globals.
+ */
+static void
+px_js_collect_declarations (GArray     *tokens,
+                            GHashTable *declared,
+                            GHashTable *globals)
+{
+  for (guint idx = 0; idx + 1 < tokens->len; idx++) {
+    PxJsToken *token = &g_array_index (tokens, PxJsToken, idx);
+    PxJsToken *next = &g_array_index (tokens, PxJsToken, idx + 1);
+    char *name;
+
+    if (next->type == PX_JS_IDENTIFIER &&
+        (px_js_token_is_one_of (token, declaration_keywords) || px_js_token_is (token, "function"))) {
+      name = g_strndup (next->start, next->len);
+      if (token->depth == 0)
+        g_hash_table_add (globals, g_strdup (name));
+      g_hash_table_add (declared, name);
+    }
+
+    /* Parameters of functions and catch clauses */
+    if (px_js_token_is (token, "function") || px_js_token_is (token, "catch")) {
+      guint param = idx + 1;
+
+      while (param < tokens->len && !px_js_token_is (&g_array_index (tokens, PxJsToken, param), "("))
+        param++;
+
+      for (param++; param < tokens->len; param++) {
+        PxJsToken *param_token = &g_array_index (tokens, PxJsToken, param);
+
+        if (px_js_token_is (param_token, ")"))
+          break;
+        if (param_token->type == PX_JS_IDENTIFIER)
+          g_hash_table_add (declared, g_strndup (param_token->start, param_token->len));
+      }
+    }
+  }
+}
+
+/*
+ * Find the url parameter of the top level FindProxyForURL(). Returns the
+ * index of its token, or 0 if there is no single such function.
+ */
+static guint
+px_js_find_url_param (GArray *tokens)
+{
+  guint url_param = 0;
+
+  for (guint idx = 0; idx + 3 < tokens->len; idx++) {
+    PxJsToken *token = &g_array_index (tokens, PxJsToken, idx);
+
+    if (!px_js_token_is (token, "FindProxyForURL"))
+      continue;
+
+    /* Any other use might replace the function */
+    if (idx == 0 || !px_js_token_is (token - 1, "function") || token->depth != 0 || url_param != 0)
+      return 0;
+
+    if (!px_js_token_is (token + 1, "(") || (token + 2)->type != PX_JS_IDENTIFIER)
+      return 0;
+
+    url_param = idx + 2;
+  }
+
+  return url_param;
+}
+
+/* Whether the identifier at @idx is assigned to */
+static gboolean
+px_js_is_assigned (GArray *tokens,
+                   guint   idx)
+{
+  if (idx + 1 < tokens->len && px_js_token_is_one_of (&g_array_index (tokens, PxJsToken, idx + 1), assignments))
+    return TRUE;
+
+  return idx > 0 && (px_js_token_is (&g_array_index (tokens, PxJsToken, idx - 1), "++") ||
+                     px_js_token_is (&g_array_index (tokens, PxJsToken, idx - 1), "--"));
+}
+
+/*
+ * Whether the assignment or increment at @idx modifies a property, as in
+ * "a.b = c", "a[b] += c", "a.b++" or "++a[b]".
+ */
+static gboolean
+px_js_assigns_member (GArray *tokens,
+                      guint   idx)
+{
+  PxJsToken *token = &g_array_index (tokens, PxJsToken, idx);
+
+  if (idx > 0 && px_js_token_is (token - 1, "]"))
+    return TRUE;
+
+  if (idx > 1 && (token - 1)->type == PX_JS_IDENTIFIER && px_js_token_is (token - 2, "."))
+    return TRUE;
+
+  if (!px_js_token_is (token, "++") && !px_js_token_is (token, "--"))
+    return FALSE;
+
+  return idx + 2 < tokens->len &&
+         (token + 1)->type == PX_JS_IDENTIFIER &&
+         (px_js_token_is (token + 2, ".") || px_js_token_is (token + 2, "["));
+}
+
+/*
+ * Find the object a chain of member accesses ending with the identifier at
+ * @idx starts from. Returns the index of its identifier, or G_MAXUINT if it
+ * is not a plain identifier.
+ */
+static guint
+px_js_find_member_base (GArray *tokens,
+                        guint   idx)
+{
+  while (idx >= 2 && px_js_token_is (&g_array_index (tokens, PxJsToken, idx - 1), ".")) {
+    idx -= 2;
+
+    /* Step back over index expressions */
+    while (px_js_token_is (&g_array_index (tokens, PxJsToken, idx), "]")) {
+      guint level = 0;
+
+      for (;; idx--) {
+        PxJsToken *token = &g_array_index (tokens, PxJsToken, idx);
+
+        if (px_js_token_is (token, "]"))
+          level++;
+        else if (px_js_token_is (token, "[") && --level == 0)
+          break;
+
+        if (idx == 0)
+          return G_MAXUINT;
+      }
+
+      if (idx == 0)
+        return G_MAXUINT;
+      idx--;
+    }
+
+    if (g_array_index (tokens, PxJsToken, idx).type != PX_JS_IDENTIFIER)
+      return G_MAXUINT;
+  }
+
+  return idx;
+}
+
+/* Whether @name refers to a variable which outlives a call */
+static gboolean
+px_js_is_global (GHashTable *declared,
+                 GHashTable *globals,
+                 const char *name)
+{
+  return g_hash_table_contains (globals, name) || !g_hash_table_contains (declared, name);
+}
+
+/**
+ * px_pac_analyze:
+ * @source: the PAC file
+ * @len: length of @source
+ *
+ * Find out what the result of FindProxyForURL() in @source may depend on
+ * besides the host. The analysis errs on the side of reporting too many
+ * dependencies.
+ *
+ * Returns: the dependencies
+ */
+PxPacDependencies
+px_pac_analyze (const char *source,
+                gsize       len)
+{
+  g_autoptr (GArray) tokens = g_array_new (FALSE, FALSE, sizeof (PxJsToken));
+  g_autoptr (GHashTable) declared = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_autoptr (GHashTable) globals = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  PxPacDependencies dependencies = 0;
+  PxJsToken *url_param;
+  guint url_param_idx;
+
+  if (!px_js_tokenize (source, len, tokens))
+    return PX_PAC_DEPENDS_ALL;
+
+  url_param_idx = px_js_find_url_param (tokens);
+  if (url_param_idx == 0)
+    return PX_PAC_DEPENDS_ALL;
+  url_param = &g_array_index (tokens, PxJsToken, url_param_idx);
+
+  px_js_collect_declarations (tokens, declared, globals);
+
+  for (guint idx = 0; idx < tokens->len; idx++) {
+    PxJsToken *token = &g_array_index (tokens, PxJsToken, idx);
+    gboolean member = idx > 0 && px_js_token_is (token - 1, ".");
+    g_autofree char *name = NULL;
+
+    /* Properties might belong to objects which outlive the call */
+    if (token->type == PX_JS_PUNCTUATOR && token->depth > 0 &&
+        px_js_token_is_one_of (token, assignments) && px_js_assigns_member (tokens, idx))
+      dependencies |= PX_PAC_DEPENDS_STATE;
+
+    if (token->type != PX_JS_IDENTIFIER)
+      continue;
+
+    if (token->depth > 0 && !member && px_js_token_is (token, "delete"))
+      dependencies |= PX_PAC_DEPENDS_STATE;
+
+    if (px_js_token_is_one_of (token, time_names))
+      dependencies |= PX_PAC_DEPENDS_TIME;
+
+    if (px_js_token_is (token, "Date"))
+      dependencies |= PX_PAC_DEPENDS_CLOCK;
+
+    if (px_js_token_is_one_of (token, dns_names))
+      dependencies |= PX_PAC_DEPENDS_DNS;
+
+    if (member) {
+      if (px_js_token_is (token, "random"))
+        dependencies |= PX_PAC_DEPENDS_STATE;
+
+      if (token->depth > 0 && px_js_token_is_one_of (token, mutating_names) &&
+          idx + 1 < tokens->len && px_js_token_is (token + 1, "(")) {
+        guint base = px_js_find_member_base (tokens, idx);
+
+        if (base == G_MAXUINT) {
+          dependencies |= PX_PAC_DEPENDS_STATE;
+        } else {
+          PxJsToken *base_token = &g_array_index (tokens, PxJsToken, base);
+
+          name = g_strndup (base_token->start, base_token->len);
+          if (px_js_is_global (declared, globals, name))
+            dependencies |= PX_PAC_DEPENDS_STATE;
+        }
+      }
+      continue;
+    }
+
+    if (px_js_token_is_one_of (token, opaque_names))
+      return PX_PAC_DEPENDS_ALL;
+
+    if (idx != url_param_idx && px_js_token_equal (token, url_param))
+      dependencies |= PX_PAC_DEPENDS_URL;
+
+    if (token->depth == 0 || !px_js_is_assigned (tokens, idx))
+      continue;
+
+    name = g_strndup (token->start, token->len);
+    if (px_js_is_global (declared, globals, name))
+      dependencies |= PX_PAC_DEPENDS_STATE;
+  }
+
+  return dependencies;
+}
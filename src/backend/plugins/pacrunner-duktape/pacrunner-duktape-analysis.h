@@ -0,0 +1,85 @@
+/* pacrunner-duktape-analysis.h
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * PxPacDependencies:
+ * @PX_PAC_DEPENDS_URL: the result may depend on more of the url than its host
+ * @PX_PAC_DEPENDS_TIME: the result may depend on the time predicates
+ * @PX_PAC_DEPENDS_DNS: the result may depend on DNS or the local addresses
+ * @PX_PAC_DEPENDS_STATE: the result may depend on earlier evaluations
+ * @PX_PAC_DEPENDS_CLOCK: the result may depend on the current time read
+ *   other than through the time predicates
+ *
+ * What the result of FindProxyForURL() may depend on besides the host.
+ */
+typedef enum {
+  PX_PAC_DEPENDS_URL = 1 << 0,
+  PX_PAC_DEPENDS_TIME = 1 << 1,
+  PX_PAC_DEPENDS_DNS = 1 << 2,
+  PX_PAC_DEPENDS_STATE = 1 << 3,
+  PX_PAC_DEPENDS_CLOCK = 1 << 4,
+} PxPacDependencies;
+
+#define PX_PAC_DEPENDS_ALL (PX_PAC_DEPENDS_URL | PX_PAC_DEPENDS_TIME | PX_PAC_DEPENDS_DNS | PX_PAC_DEPENDS_STATE | PX_PAC_DEPENDS_CLOCK)
+
+typedef enum {
+  PX_JS_IDENTIFIER,
+  PX_JS_PUNCTUATOR,
+  PX_JS_LITERAL,
+} PxJsTokenType;
+
+/**
+ * PxJsToken:
+ * @type: kind of token
+ * @start: start of the token in the source
+ * @len: length of the token
+ * @depth: number of braces the token is nested in
+ *
+ * A token of a PAC file. String and regular expression literals include
+ * their delimiters.
+ */
+typedef struct {
+  PxJsTokenType type;
+  const char *start;
+  gsize len;
+  guint depth;
+} PxJsToken;
+
+gboolean px_js_tokenize (const char *source,
+                         gsize       len,
+                         GArray     *tokens);
+
+gboolean px_js_token_is (PxJsToken  *token,
+                         const char *str);
+
+gboolean px_js_token_is_one_of (PxJsToken   *token,
+                                const char **strs);
+
+PxPacDependencies px_pac_analyze (const char *source,
+                                  gsize       len);
+
+G_END_DECLS
@@ -0,0 +1,306 @@
+/* pacrunner-duktape-arena.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pacrunner-duktape-arena.h"
+
+/**
+ * PxDuktapeArena:
+ *
+ * Allocator for a single duktape heap. Small blocks are carved out of
+ * slabs and kept on per size class free lists, larger ones come from
+ * malloc(). Every block is preceded by a header recording its size, which
+ * is used to enforce a limit on the memory in use.
+ *
+ * Slabs are only returned to the system when the arena is freed, so the
+ * memory held by an arena is that of its peak use. Arenas are not thread
+ * safe, just like the heap using them.
+ */
+
+#define PX_ARENA_SLAB_SIZE (16 * 1024)
+#define PX_ARENA_N_CLASSES 6
+#define PX_ARENA_LARGE PX_ARENA_N_CLASSES
+
+static const gsize class_sizes[PX_ARENA_N_CLASSES] = { 16, 32, 64, 128, 256, 512 };
+
+/* Keeps the blocks following it aligned for any type */
+typedef union {
+  struct {
+    gsize size;
+    guint size_class;
+  };
+  long double align_ld;
+  gint64 align_i64;
+  gpointer align_ptr;
+} PxArenaHeader;
+
+typedef struct _PxArenaBlock {
+  struct _PxArenaBlock *next;
+} PxArenaBlock;
+
+struct _PxDuktapeArena {
+  PxArenaBlock *free_lists[PX_ARENA_N_CLASSES];
+  GSList *slabs;
+
+  gsize limit;
+  gsize used;
+  gsize peak;
+};
+
+static guint
+px_arena_size_class (gsize size)
+{
+  for (guint idx = 0; idx < PX_ARENA_N_CLASSES; idx++) {
+    if (size <= class_sizes[idx])
+      return idx;
+  }
+
+  return PX_ARENA_LARGE;
+}
+
+static gsize
+px_arena_block_size (guint size_class,
+                     gsize size)
+{
+  return sizeof (PxArenaHeader) + (size_class == PX_ARENA_LARGE ? size : class_sizes[size_class]);
+}
+
+/* Carve a new slab into blocks of @size_class */
+static gboolean
+px_arena_grow (PxDuktapeArena *arena,
+               guint           size_class)
+{
+  gsize block_size = px_arena_block_size (size_class, 0);
+  char *slab = malloc (PX_ARENA_SLAB_SIZE);
+
+  if (!slab)
+    return FALSE;
+
+  arena->slabs = g_slist_prepend (arena->slabs, slab);
+
+  for (gsize offset = 0; offset + block_size <= PX_ARENA_SLAB_SIZE; offset += block_size) {
+    PxArenaBlock *block = (PxArenaBlock *)(slab + offset);
+
+    block->next = arena->free_lists[size_class];
+    arena->free_lists[size_class] = block;
+  }
+
+  return TRUE;
+}
+
+/**
+ * px_duktape_arena_new:
+ * @limit: maximum number of bytes in use, or 0 for no limit
+ *
+ * Returns: (transfer full): a new arena
+ */
+PxDuktapeArena *
+px_duktape_arena_new (gsize limit)
+{
+  PxDuktapeArena *arena = g_new0 (PxDuktapeArena, 1);
+
+  arena->limit = limit;
+
+  return arena;
+}
+
+/**
+ * px_duktape_arena_free:
+ * @arena: a `PxDuktapeArena`
+ *
+ * Free @arena and all memory allocated from it.
+ */
+void
+px_duktape_arena_free (PxDuktapeArena *arena)
+{
+  g_slist_free_full (arena->slabs, free);
+  g_free (arena);
+}
+
+/**
+ * px_duktape_arena_alloc:
+ * @arena: a `PxDuktapeArena`
+ * @size: number of bytes to allocate
+ *
+ * Returns: (nullable): the allocated memory or %NULL if the limit would be
+ *   exceeded or the system is out of memory
+ */
+gpointer
+px_duktape_arena_alloc (PxDuktapeArena *arena,
+                        gsize           size)
+{
+  guint size_class = px_arena_size_class (size);
+  gsize block_size = px_arena_block_size (size_class, size);
+  PxArenaHeader *header;
+
+  if (arena->limit > 0 && arena->used + block_size > arena->limit)
+    return NULL;
+
+  if (size_class == PX_ARENA_LARGE) {
+    header = malloc (block_size);
+    if (!header)
+      return NULL;
+  } else {
+    if (!arena->free_lists[size_class] && !px_arena_grow (arena, size_class))
+      return NULL;
+
+    header = (PxArenaHeader *)arena->free_lists[size_class];
+    arena->free_lists[size_class] = arena->free_lists[size_class]->next;
+  }
+
+  header->size = size;
+  header->size_class = size_class;
+
+  arena->used += block_size;
+  arena->peak = MAX (arena->peak, arena->used);
+
+  return header + 1;
+}
+
+/**
+ * px_duktape_arena_release:
+ * @arena: a `PxDuktapeArena`
+ * @ptr: (nullable): memory allocated from @arena
+ *
+ * Return @ptr to @arena.
+ */
+void
+px_duktape_arena_release (PxDuktapeArena *arena,
+                          gpointer        ptr)
+{
+  PxArenaHeader *header;
+  PxArenaBlock *block;
+
+  if (!ptr)
+    return;
+
+  header = (PxArenaHeader *)ptr - 1;
+  arena->used -= px_arena_block_size (header->size_class, header->size);
+
+  if (header->size_class == PX_ARENA_LARGE) {
+    free (header);
+    return;
+  }
+
+  block = (PxArenaBlock *)header;
+  block->next = arena->free_lists[header->size_class];
+  arena->free_lists[header->size_class] = block;
+}
+
+/**
+ * px_duktape_arena_realloc:
+ * @arena: a `PxDuktapeArena`
+ * @ptr: (nullable): memory allocated from @arena
+ * @size: new size in bytes, 0 releases @ptr
+ *
+ * Shrinking never fails, even at the limit.
+ *
+ * Returns: (nullable): the reallocated memory, or %NULL if @size is 0 or
+ *   the allocation failed, in which case @ptr is left untouched
+ */
+gpointer
+px_duktape_arena_realloc (PxDuktapeArena *arena,
+                          gpointer        ptr,
+                          gsize           size)
+{
+  PxArenaHeader *header;
+  gpointer new_ptr;
+  gsize old_size;
+
+  if (!ptr)
+    return px_duktape_arena_alloc (arena, size);
+
+  if (size == 0) {
+    px_duktape_arena_release (arena, ptr);
+    return NULL;
+  }
+
+  /* Blocks of a size class have room up to the class size */
+  header = (PxArenaHeader *)ptr - 1;
+  if (header->size_class != PX_ARENA_LARGE && px_arena_size_class (size) == header->size_class) {
+    header->size = size;
+    return ptr;
+  }
+
+  /* Large blocks shrink in place */
+  old_size = header->size;
+  if (header->size_class == PX_ARENA_LARGE && px_arena_size_class (size) == PX_ARENA_LARGE && size <= old_size) {
+    PxArenaHeader *shrunk = realloc (header, px_arena_block_size (PX_ARENA_LARGE, size));
+
+    if (!shrunk)
+      return ptr;
+
+    shrunk->size = size;
+    arena->used -= old_size - size;
+
+    return shrunk + 1;
+  }
+
+  /* Keep the larger block if there is no room for a copy */
+  new_ptr = px_duktape_arena_alloc (arena, size);
+  if (!new_ptr)
+    return size < old_size ? ptr : NULL;
+
+  memcpy (new_ptr, ptr, MIN (header->size, size));
+  px_duktape_arena_release (arena, ptr);
+
+  return new_ptr;
+}
+
+/**
+ * px_duktape_arena_get_size:
+ * @arena: a `PxDuktapeArena`
+ * @ptr: memory allocated from @arena
+ *
+ * Returns: the size @ptr was last allocated or reallocated with
+ */
+gsize
+px_duktape_arena_get_size (PxDuktapeArena *arena,
+                           gpointer        ptr)
+{
+  return ((PxArenaHeader *)ptr - 1)->size;
+}
+
+/**
+ * px_duktape_arena_get_used:
+ * @arena: a `PxDuktapeArena`
+ *
+ * Returns: the number of bytes currently allocated, including headers
+ */
+gsize
+px_duktape_arena_get_used (PxDuktapeArena *arena)
+{
+  return arena->used;
+}
+
+/**
+ * px_duktape_arena_get_peak:
+ * @arena: a `PxDuktapeArena`
+ *
+ * Returns: the highest number of bytes allocated at the same time
+ */
+gsize
+px_duktape_arena_get_peak (PxDuktapeArena *arena)
+{
+  return arena->peak;
+}
@@ -0,0 +1,51 @@
+/* pacrunner-duktape-arena.h
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PxDuktapeArena PxDuktapeArena;
+
+PxDuktapeArena *px_duktape_arena_new (gsize limit);
+
+void px_duktape_arena_free (PxDuktapeArena *arena);
+
+gpointer px_duktape_arena_alloc (PxDuktapeArena *arena,
+                                 gsize           size);
+
+gpointer px_duktape_arena_realloc (PxDuktapeArena *arena,
+                                   gpointer        ptr,
+                                   gsize           size);
+
+void px_duktape_arena_release (PxDuktapeArena *arena,
+                               gpointer        ptr);
+
+gsize px_duktape_arena_get_size (PxDuktapeArena *arena,
+                                gpointer        ptr);
+
+gsize px_duktape_arena_get_used (PxDuktapeArena *arena);
+
+gsize px_duktape_arena_get_peak (PxDuktapeArena *arena);
+
+G_END_DECLS
@@ -0,0 +1,85 @@
+/* pacrunner-duktape-compile.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Build time helper compiling JAVASCRIPT_ROUTINES to duktape bytecode and
+ * writing it out as a C header, so heaps do not have to compile the PAC
+ * helpers at runtime.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pacutils.h"
+
+#include "duktape.h"
+
+int
+main (int    argc,
+      char **argv)
+{
+  duk_context *ctx;
+  unsigned char *bytecode;
+  duk_size_t size;
+  FILE *out;
+
+  if (argc != 2) {
+    fprintf (stderr, "Usage: %s OUTPUT\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  ctx = duk_create_heap_default ();
+  if (!ctx) {
+    fprintf (stderr, "Could not create duktape heap\n");
+    return EXIT_FAILURE;
+  }
+
+  if (duk_pcompile_string (ctx, 0, JAVASCRIPT_ROUTINES)) {
+    fprintf (stderr, "Could not compile PAC helpers: %s\n", duk_safe_to_string (ctx, -1));
+    return EXIT_FAILURE;
+  }
+
+  duk_dump_function (ctx);
+  bytecode = duk_get_buffer_data (ctx, -1, &size);
+
+  out = fopen (argv[1], "w");
+  if (!out) {
+    perror (argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  fprintf (out, "/* Generated by pacrunner-duktape-compile, do not edit */\n\n");
+  fprintf (out, "#pragma once\n\n");
+  fprintf (out, "#define PX_DUKTAPE_ROUTINES_VERSION %ld\n\n", (long)DUK_VERSION);
+  fprintf (out, "static const unsigned char px_duktape_routines_bytecode[] = {");
+  for (duk_size_t idx = 0; idx < size; idx++)
+    fprintf (out, "%s0x%02x,", idx % 12 == 0 ? "\n  " : " ", bytecode[idx]);
+  fprintf (out, "\n};\n");
+
+  if (fclose (out) != 0) {
+    perror (argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  duk_destroy_heap (ctx);
+
+  return EXIT_SUCCESS;
+}
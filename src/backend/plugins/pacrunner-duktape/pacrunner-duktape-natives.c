@@ -0,0 +1,1297 @@
+/* pacrunner-duktape-natives.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "pacrunner-duktape-natives.h"
+#include "pacutils.h"
+
+#ifdef PX_DUKTAPE_PRECOMPILED_ROUTINES
+#include "pacrunner-duktape-routines.h"
+#endif
+
+/*
+ * Native versions of the PAC helpers from JAVASCRIPT_ROUTINES. They follow
+ * the JavaScript versions, including their quirks, so PAC files behave the
+ * same whichever version is used. shExpMatch() and localHostOrDomainIs()
+ * turn their arguments into regular expressions, so arguments the native
+ * versions cannot handle the same way are passed on to the JavaScript
+ * versions, which are kept for that.
+ *
+ * dnsDomainIsAny() and shExpMatchAny() are extensions without JavaScript
+ * versions, for PAC files which check hosts against long lists. Their
+ * patterns only treat '*' and '?' specially.
+ */
+
+/* Property of a native holding the JavaScript version it replaces */
+#define PX_DUKTAPE_SCRIPT DUK_HIDDEN_SYMBOL ("pxScript")
+
+static const char *wdays[] = { "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT", NULL };
+static const char *months[] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC", NULL };
+
+static int
+px_pac_lookup_name (const char **names,
+                    const char  *name)
+{
+  for (int idx = 0; names[idx]; idx++) {
+    if (g_strcmp0 (names[idx], name) == 0)
+      return idx;
+  }
+
+  return -1;
+}
+
+static gboolean
+px_pac_is_space (char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/* JavaScript ToNumber() for strings, returns NAN if @str is not a number */
+static double
+px_pac_to_number (const char *str)
+{
+  g_autofree char *stripped = g_strstrip (g_strdup (str));
+  char *end = NULL;
+  double value;
+
+  if (!*stripped)
+    return 0;
+
+  if (stripped[0] == '0' && (stripped[1] == 'x' || stripped[1] == 'X')) {
+    if (!g_ascii_isxdigit (stripped[2]))
+      return NAN;
+
+    value = g_ascii_strtoull (stripped + 2, &end, 16);
+    return *end ? NAN : value;
+  }
+
+  if (strcmp (stripped, "Infinity") == 0 || strcmp (stripped, "+Infinity") == 0)
+    return INFINITY;
+  if (strcmp (stripped, "-Infinity") == 0)
+    return -INFINITY;
+
+  /* strtod() also accepts hexadecimal, infinity and nan */
+  for (const char *c = stripped; *c; c++) {
+    if (!g_ascii_isdigit (*c) && !strchr ("+-.eE", *c))
+      return NAN;
+  }
+
+  value = g_ascii_strtod (stripped, &end);
+
+  return *end ? NAN : value;
+}
+
+/* JavaScript parseInt() without radix, returns NAN if @str has no digits */
+static double
+px_pac_parse_int (const char *str)
+{
+  double value = 0;
+  double sign = 1;
+  int base = 10;
+  gboolean digits = FALSE;
+
+  while (px_pac_is_space (*str))
+    str++;
+
+  if (*str == '-' || *str == '+') {
+    sign = *str == '-' ? -1 : 1;
+    str++;
+  }
+
+  if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+    base = 16;
+    str += 2;
+  }
+
+  for (; *str; str++) {
+    int digit = g_ascii_xdigit_value (*str);
+
+    if (digit < 0 || digit >= base)
+      break;
+
+    value = value * base + digit;
+    digits = TRUE;
+  }
+
+  return digits ? sign * value : NAN;
+}
+
+/* The lowest 8 bits of JavaScript ToInt32() */
+static guint32
+px_pac_to_byte (double value)
+{
+  if (!isfinite (value))
+    return 0;
+
+  value = fmod (trunc (value), 256);
+  if (value < 0)
+    value += 256;
+
+  return (guint32)value;
+}
+
+/**
+ * px_pac_sh_exp_pattern_is_simple:
+ * @pattern: shell expression
+ *
+ * shExpMatch() turns @pattern into a regular expression, escaping '.' and
+ * replacing the wildcards '*' and '?' only.
+ *
+ * Returns: %TRUE if @pattern uses no other regular expression syntax, so
+ *   px_pac_sh_exp_match() can match it
+ */
+gboolean
+px_pac_sh_exp_pattern_is_simple (const char *pattern)
+{
+  return g_utf8_validate (pattern, -1, NULL) && !strpbrk (pattern, "\\^$+()[]{}|");
+}
+
+/**
+ * px_pac_sh_exp_string_is_simple:
+ * @str: string to match
+ *
+ * The wildcards of shExpMatch() match any UTF-16 code unit except line
+ * terminators.
+ *
+ * Returns: %TRUE if every character of @str is a single code unit and no
+ *   line terminator, so px_pac_sh_exp_match() can match it
+ */
+gboolean
+px_pac_sh_exp_string_is_simple (const char *str)
+{
+  if (!g_utf8_validate (str, -1, NULL))
+    return FALSE;
+
+  for (; *str; str = g_utf8_next_char (str)) {
+    gunichar c = g_utf8_get_char (str);
+
+    if (c == '\n' || c == '\r' || c == 0x2028 || c == 0x2029 || c > 0xffff)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * px_pac_sh_exp_match:
+ * @str: string to match
+ * @pattern: shell expression with '*' and '?' wildcards
+ *
+ * Other characters match literally, which is what shExpMatch() does if
+ * px_pac_sh_exp_pattern_is_simple() and px_pac_sh_exp_string_is_simple()
+ * hold.
+ *
+ * Returns: %TRUE if @pattern matches all of @str
+ */
+gboolean
+px_pac_sh_exp_match (const char *str,
+                     const char *pattern)
+{
+  const char *star = NULL;
+  const char *resume = NULL;
+
+  while (*str) {
+    if (*pattern == '*') {
+      /* Remember the position to backtrack to */
+      star = ++pattern;
+      resume = str;
+    } else if (*pattern == '?') {
+      pattern++;
+      str = g_utf8_next_char (str);
+    } else if (*pattern && *pattern == *str) {
+      pattern++;
+      str++;
+    } else if (star) {
+      pattern = star;
+      resume = g_utf8_next_char (resume);
+      str = resume;
+    } else {
+      return FALSE;
+    }
+  }
+
+  while (*pattern == '*')
+    pattern++;
+
+  return *pattern == '\0';
+}
+
+/**
+ * px_pac_dns_domain_is:
+ * @host: host name
+ * @domain: domain name
+ *
+ * Returns: %TRUE if @host ends with @domain
+ */
+gboolean
+px_pac_dns_domain_is (const char *host,
+                      const char *domain)
+{
+  return g_str_has_suffix (host, domain);
+}
+
+/**
+ * px_pac_local_host_or_domain_is:
+ * @host: host name
+ * @hostdom: fully qualified host name
+ *
+ * For plain host names, the JavaScript version searches @hostdom for the
+ * regular expression "/^" @host "/", which cannot match unless @host
+ * contains regular expression syntax itself. Such hosts are not handled.
+ *
+ * Returns: %TRUE if @host is not a plain host name and equals @hostdom
+ */
+gboolean
+px_pac_local_host_or_domain_is (const char *host,
+                                const char *hostdom)
+{
+  if (!strchr (host, '.'))
+    return FALSE;
+
+  return strcmp (host, hostdom) == 0;
+}
+
+/**
+ * px_pac_convert_addr:
+ * @ipchars: dotted IPv4 address
+ *
+ * Convert @ipchars to an integer the same way convert_addr() does. Missing
+ * or invalid parts are treated as 0.
+ *
+ * Returns: the address in host byte order
+ */
+guint32
+px_pac_convert_addr (const char *ipchars)
+{
+  g_auto (GStrv) bytes = g_strsplit (ipchars, ".", -1);
+  guint32 result = 0;
+  guint len = g_strv_length (bytes);
+
+  for (guint idx = 0; idx < 4; idx++) {
+    guint32 byte = idx < len ? px_pac_to_byte (px_pac_to_number (bytes[idx])) : 0;
+
+    result = (result << 8) | byte;
+  }
+
+  return result;
+}
+
+/**
+ * px_pac_is_dotted_quad:
+ * @ipaddr: string to check
+ * @valid: (out): whether all parts are in range
+ *
+ * Returns: %TRUE if @ipaddr consists of four groups of one to three
+ *   digits separated by dots
+ */
+gboolean
+px_pac_is_dotted_quad (const char *ipaddr,
+                       gboolean   *valid)
+{
+  const char *c = ipaddr;
+
+  *valid = TRUE;
+
+  for (int part = 0; part < 4; part++) {
+    int value = 0;
+    int digits = 0;
+
+    if (part > 0 && *c++ != '.')
+      return FALSE;
+
+    for (; g_ascii_isdigit (*c) && digits < 3; c++, digits++)
+      value = value * 10 + g_ascii_digit_value (*c);
+
+    if (digits == 0)
+      return FALSE;
+
+    if (value > 255)
+      *valid = FALSE;
+  }
+
+  return *c == '\0';
+}
+
+/*
+ * dnsDomainIsAny() and shExpMatchAny() match a host against a whole list
+ * of domains or patterns. Each list is compiled on first use into a
+ * matcher, which is kept in a hidden property of the list, so later calls
+ * with the same list only walk the host once:
+ *
+ * - domains, and patterns of the form "*suffix", go into a trie of
+ *   reversed suffixes,
+ * - patterns without wildcards go into the same trie, marked as exact,
+ * - and all other patterns into a list of globs.
+ *
+ * A matcher is a buffer on the duktape heap, so it counts against the
+ * memory limit and goes away with its list. Lists are not expected to
+ * change once used; only a change of their length rebuilds the matcher.
+ */
+typedef struct {
+  guint32 length;
+  guint32 n_nodes;
+  guint32 n_globs;
+} PxPacMatcher;
+
+typedef struct {
+  guint32 first_child;
+  guint32 next_sibling;
+  guint8 flags;
+  char c;
+} PxPacMatcherNode;
+
+#define PX_PAC_MATCHER_SUFFIX (1 << 0)
+#define PX_PAC_MATCHER_EXACT (1 << 1)
+
+#define px_pac_matcher_get_nodes(matcher) ((PxPacMatcherNode *)((matcher) + 1))
+
+static guint32
+px_pac_matcher_get_child (PxPacMatcherNode *nodes,
+                          guint32           node,
+                          char              c)
+{
+  for (guint32 child = nodes[node].first_child; child != 0; child = nodes[child].next_sibling) {
+    if (nodes[child].c == c)
+      return child;
+  }
+
+  return 0;
+}
+
+/* Add @str to the trie, which must have room for its nodes */
+static void
+px_pac_matcher_add (PxPacMatcher *matcher,
+                    const char   *str,
+                    guint8        flags)
+{
+  PxPacMatcherNode *nodes = px_pac_matcher_get_nodes (matcher);
+  guint32 node = 0;
+
+  for (gsize idx = strlen (str); idx > 0; idx--) {
+    guint32 child = px_pac_matcher_get_child (nodes, node, str[idx - 1]);
+
+    if (child == 0) {
+      child = matcher->n_nodes++;
+      nodes[child].first_child = 0;
+      nodes[child].next_sibling = nodes[node].first_child;
+      nodes[child].flags = 0;
+      nodes[child].c = str[idx - 1];
+      nodes[node].first_child = child;
+    }
+
+    node = child;
+  }
+
+  nodes[node].flags |= flags;
+}
+
+static gboolean
+px_pac_matcher_match (PxPacMatcher *matcher,
+                      const char   *host)
+{
+  PxPacMatcherNode *nodes = px_pac_matcher_get_nodes (matcher);
+  const char *glob = (const char *)(nodes + matcher->n_nodes);
+  gsize len = strlen (host);
+  guint32 node = 0;
+
+  if (nodes[0].flags & PX_PAC_MATCHER_SUFFIX || (len == 0 && nodes[0].flags & PX_PAC_MATCHER_EXACT))
+    return TRUE;
+
+  for (gsize idx = len; idx > 0; idx--) {
+    node = px_pac_matcher_get_child (nodes, node, host[idx - 1]);
+    if (node == 0)
+      break;
+
+    if (nodes[node].flags & PX_PAC_MATCHER_SUFFIX || (idx == 1 && nodes[node].flags & PX_PAC_MATCHER_EXACT))
+      return TRUE;
+  }
+
+  for (guint32 idx = 0; idx < matcher->n_globs; idx++) {
+    if (px_pac_sh_exp_match (host, glob))
+      return TRUE;
+
+    glob += strlen (glob) + 1;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+px_pac_is_ascii (const char *str)
+{
+  for (; *str; str++) {
+    if ((guchar)*str >= 0x80)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/*
+ * Dates are handled like JavaScript Date objects in local time: every
+ * setter normalizes the broken down time, so out of range values carry
+ * over into the next field.
+ */
+typedef struct {
+  struct tm tm;
+  int ms;
+  gboolean valid;
+} PxPacDate;
+
+static void
+px_pac_date_normalize (PxPacDate *date)
+{
+  date->tm.tm_isdst = -1;
+  if (date->valid && mktime (&date->tm) == (time_t)-1)
+    date->valid = FALSE;
+}
+
+static void
+px_pac_date_init (PxPacDate *date,
+                  GDateTime *dt,
+                  int        ms)
+{
+  memset (date, 0, sizeof (*date));
+  date->tm.tm_year = g_date_time_get_year (dt) - 1900;
+  date->tm.tm_mon = g_date_time_get_month (dt) - 1;
+  date->tm.tm_mday = g_date_time_get_day_of_month (dt);
+  date->tm.tm_hour = g_date_time_get_hour (dt);
+  date->tm.tm_min = g_date_time_get_minute (dt);
+  date->tm.tm_sec = g_date_time_get_second (dt);
+  date->ms = ms;
+  date->valid = TRUE;
+  px_pac_date_normalize (date);
+}
+
+static void
+px_pac_date_init_ymdhms (PxPacDate *date,
+                         int        year,
+                         int        month,
+                         int        day,
+                         int        hour,
+                         int        minute,
+                         int        second)
+{
+  memset (date, 0, sizeof (*date));
+  date->tm.tm_year = year - 1900;
+  date->tm.tm_mon = month;
+  date->tm.tm_mday = day;
+  date->tm.tm_hour = hour;
+  date->tm.tm_min = minute;
+  date->tm.tm_sec = second;
+  date->valid = TRUE;
+  px_pac_date_normalize (date);
+}
+
+/* Set one field like the JavaScript setters, NAN makes the date invalid */
+static void
+px_pac_date_set (PxPacDate *date,
+                 int       *field,
+                 double     value,
+                 int        offset)
+{
+  /* Way beyond the range of JavaScript dates */
+  if (isnan (value) || fabs (value) > 1e9) {
+    date->valid = FALSE;
+    return;
+  }
+
+  *field = (int)trunc (value) - offset;
+  px_pac_date_normalize (date);
+}
+
+static gint64
+px_pac_date_get_time (PxPacDate *date)
+{
+  struct tm tm = date->tm;
+
+  return (gint64)mktime (&tm) * 1000 + date->ms;
+}
+
+static gboolean
+px_pac_date_le (PxPacDate *a,
+                PxPacDate *b)
+{
+  return a->valid && b->valid && px_pac_date_get_time (a) <= px_pac_date_get_time (b);
+}
+
+/* Turn the local time @date into one showing the UTC time, field by field */
+static void
+px_pac_date_set_utc (PxPacDate *date,
+                     GDateTime *utc)
+{
+  px_pac_date_set (date, &date->tm.tm_year, g_date_time_get_year (utc), 1900);
+  px_pac_date_set (date, &date->tm.tm_mon, g_date_time_get_month (utc) - 1, 0);
+  px_pac_date_set (date, &date->tm.tm_mday, g_date_time_get_day_of_month (utc), 0);
+  px_pac_date_set (date, &date->tm.tm_hour, g_date_time_get_hour (utc), 0);
+  px_pac_date_set (date, &date->tm.tm_min, g_date_time_get_minute (utc), 0);
+  px_pac_date_set (date, &date->tm.tm_sec, g_date_time_get_second (utc), 0);
+}
+
+/**
+ * px_pac_weekday_range:
+ * @argv: arguments of weekdayRange()
+ * @argc: number of arguments
+ * @now: current time in microseconds since the epoch
+ *
+ * Returns: the result of weekdayRange()
+ */
+gboolean
+px_pac_weekday_range (const char * const *argv,
+                      int                 argc,
+                      gint64              now)
+{
+  g_autoptr (GDateTime) dt = NULL;
+  int wday;
+  int wd1;
+  int wd2;
+
+  if (argc < 1)
+    return FALSE;
+
+  if (g_strcmp0 (argv[argc - 1], "GMT") == 0) {
+    argc--;
+    dt = g_date_time_new_from_unix_utc (now / G_USEC_PER_SEC);
+  } else {
+    dt = g_date_time_new_from_unix_local (now / G_USEC_PER_SEC);
+  }
+
+  wday = g_date_time_get_day_of_week (dt) % 7;
+  wd1 = px_pac_lookup_name (wdays, argv[0]);
+  wd2 = argc == 2 ? px_pac_lookup_name (wdays, argv[1]) : wd1;
+
+  return wd1 != -1 && wd2 != -1 && wd1 <= wday && wday <= wd2;
+}
+
+/**
+ * px_pac_date_range:
+ * @argv: arguments of dateRange()
+ * @argc: number of arguments
+ * @now: current time in microseconds since the epoch
+ *
+ * Returns: the result of dateRange()
+ */
+gboolean
+px_pac_date_range (const char * const *argv,
+                   int                 argc,
+                   gint64              now)
+{
+  g_autoptr (GDateTime) local = g_date_time_new_from_unix_local (now / G_USEC_PER_SEC);
+  g_autoptr (GDateTime) utc = g_date_time_new_from_unix_utc (now / G_USEC_PER_SEC);
+  PxPacDate date;
+  PxPacDate date1;
+  PxPacDate date2;
+  gboolean is_gmt;
+  gboolean adjust_month = FALSE;
+  int year;
+
+  if (argc < 1)
+    return FALSE;
+
+  is_gmt = g_strcmp0 (argv[argc - 1], "GMT") == 0;
+  if (is_gmt)
+    argc--;
+
+  if (argc == 1) {
+    double tmp = px_pac_parse_int (argv[0]);
+    GDateTime *dt = is_gmt ? utc : local;
+
+    if (isnan (tmp))
+      return g_date_time_get_month (dt) - 1 == px_pac_lookup_name (months, argv[0]);
+    else if (tmp < 32)
+      return g_date_time_get_day_of_month (dt) == tmp;
+    else
+      return g_date_time_get_year (dt) == tmp;
+  }
+
+  year = g_date_time_get_year (local);
+  px_pac_date_init_ymdhms (&date1, year, 0, 1, 0, 0, 0);
+  px_pac_date_init_ymdhms (&date2, year, 11, 31, 23, 59, 59);
+
+  for (int idx = 0; idx < argc; idx++) {
+    PxPacDate *target = idx < (argc >> 1) ? &date1 : &date2;
+    double tmp = px_pac_parse_int (argv[idx]);
+
+    if (isnan (tmp)) {
+      px_pac_date_set (target, &target->tm.tm_mon, px_pac_lookup_name (months, argv[idx]), 0);
+    } else if (tmp < 32) {
+      if (target == &date1)
+        adjust_month = argc <= 2;
+      px_pac_date_set (target, &target->tm.tm_mday, tmp, 0);
+    } else {
+      px_pac_date_set (target, &target->tm.tm_year, tmp, 1900);
+    }
+  }
+
+  if (adjust_month) {
+    px_pac_date_set (&date1, &date1.tm.tm_mon, g_date_time_get_month (local) - 1, 0);
+    px_pac_date_set (&date2, &date2.tm.tm_mon, g_date_time_get_month (local) - 1, 0);
+  }
+
+  px_pac_date_init (&date, local, (now / 1000) % 1000);
+  if (is_gmt)
+    px_pac_date_set_utc (&date, utc);
+
+  return px_pac_date_le (&date1, &date) && px_pac_date_le (&date, &date2);
+}
+
+/**
+ * px_pac_time_range:
+ * @argv: arguments of timeRange()
+ * @argc: number of arguments
+ * @now: current time in microseconds since the epoch
+ * @result: (out): the result of timeRange()
+ *
+ * Returns: %FALSE if the number of arguments is invalid
+ */
+gboolean
+px_pac_time_range (const char * const *argv,
+                   int                 argc,
+                   gint64              now,
+                   gboolean           *result)
+{
+  g_autoptr (GDateTime) local = g_date_time_new_from_unix_local (now / G_USEC_PER_SEC);
+  g_autoptr (GDateTime) utc = g_date_time_new_from_unix_utc (now / G_USEC_PER_SEC);
+  int ms = (now / 1000) % 1000;
+  PxPacDate date;
+  PxPacDate date1;
+  PxPacDate date2;
+  gboolean is_gmt = FALSE;
+  double hour;
+  int middle;
+
+  *result = FALSE;
+
+  if (argc < 1)
+    return TRUE;
+
+  if (g_strcmp0 (argv[argc - 1], "GMT") == 0) {
+    is_gmt = TRUE;
+    argc--;
+  }
+
+  hour = g_date_time_get_hour (is_gmt ? utc : local);
+
+  if (argc == 1) {
+    *result = hour == px_pac_to_number (argv[0]);
+    return TRUE;
+  } else if (argc == 2) {
+    *result = px_pac_to_number (argv[0]) <= hour && hour <= px_pac_to_number (argv[1]);
+    return TRUE;
+  } else if (argc != 4 && argc != 6) {
+    return FALSE;
+  }
+
+  px_pac_date_init (&date1, local, ms);
+  px_pac_date_init (&date2, local, ms);
+
+  if (argc == 6) {
+    px_pac_date_set (&date1, &date1.tm.tm_sec, px_pac_to_number (argv[2]), 0);
+    px_pac_date_set (&date2, &date2.tm.tm_sec, px_pac_to_number (argv[5]), 0);
+  }
+
+  middle = argc >> 1;
+  px_pac_date_set (&date1, &date1.tm.tm_hour, px_pac_to_number (argv[0]), 0);
+  px_pac_date_set (&date1, &date1.tm.tm_min, px_pac_to_number (argv[1]), 0);
+  px_pac_date_set (&date2, &date2.tm.tm_hour, px_pac_to_number (argv[middle]), 0);
+  px_pac_date_set (&date2, &date2.tm.tm_min, px_pac_to_number (argv[middle + 1]), 0);
+  if (middle == 2)
+    px_pac_date_set (&date2, &date2.tm.tm_sec, 59, 0);
+
+  px_pac_date_init (&date, local, ms);
+  if (is_gmt)
+    px_pac_date_set_utc (&date, utc);
+
+  *result = px_pac_date_le (&date1, &date) && px_pac_date_le (&date, &date2);
+  return TRUE;
+}
+
+/*
+ * The next instant after @now at which the clock in @tz shows @seconds past
+ * midnight. Wall clock times skipped by a DST change map to some time close
+ * to them, which only ever makes boundaries early.
+ */
+static gint64
+px_pac_next_time_of_day (GTimeZone *tz,
+                         gint64     now,
+                         double     seconds)
+{
+  g_autoptr (GDateTime) utc = g_date_time_new_from_unix_utc (now / G_USEC_PER_SEC);
+  g_autoptr (GDateTime) dt = g_date_time_to_timezone (utc, tz);
+  int second_of_day;
+
+  seconds = fmod (seconds, 86400);
+  if (seconds < 0)
+    seconds += 86400;
+  second_of_day = (int)seconds;
+
+  for (int day = 0; day < 3; day++) {
+    g_autoptr (GDateTime) date = g_date_time_add_days (dt, day);
+    g_autoptr (GDateTime) next = NULL;
+
+    next = g_date_time_new (tz,
+                            g_date_time_get_year (date),
+                            g_date_time_get_month (date),
+                            g_date_time_get_day_of_month (date),
+                            second_of_day / 3600,
+                            second_of_day / 60 % 60,
+                            second_of_day % 60);
+
+    if (next && g_date_time_to_unix (next) * G_USEC_PER_SEC > now)
+      return g_date_time_to_unix (next) * G_USEC_PER_SEC;
+  }
+
+  return now;
+}
+
+static gint64
+px_pac_next_times_of_day (gint64        now,
+                          const double *seconds,
+                          guint         n_seconds)
+{
+  g_autoptr (GTimeZone) local = g_time_zone_new_local ();
+  g_autoptr (GTimeZone) utc = g_time_zone_new_utc ();
+  gint64 next = G_MAXINT64;
+
+  for (guint idx = 0; idx < n_seconds; idx++) {
+    if (!isfinite (seconds[idx]))
+      continue;
+
+    next = MIN (next, px_pac_next_time_of_day (local, now, seconds[idx]));
+    next = MIN (next, px_pac_next_time_of_day (utc, now, seconds[idx]));
+  }
+
+  return next;
+}
+
+/**
+ * px_pac_day_range_next_change:
+ * @now: current time in microseconds since the epoch
+ *
+ * weekdayRange() and dateRange() only look at the calendar day, apart from
+ * dateRange() ranges ending in the last second of a day. Their result can
+ * therefore only change at midnight or at 23:59:59, in local time or UTC.
+ *
+ * Returns: the first instant after @now at which the result of
+ *   weekdayRange() or dateRange() may differ from the one at @now
+ */
+gint64
+px_pac_day_range_next_change (gint64 now)
+{
+  const double seconds[] = { 0, 86399 };
+
+  return px_pac_next_times_of_day (now, seconds, G_N_ELEMENTS (seconds));
+}
+
+/* Seconds past midnight given by the hour, minute and second in @argv */
+static double
+px_pac_time_of_day (const char * const *argv,
+                    int                 n_fields,
+                    double              offset)
+{
+  double seconds = 0;
+
+  for (int idx = 0; idx < 3; idx++) {
+    double value = idx < n_fields ? px_pac_to_number (argv[idx]) : 0;
+
+    if (isnan (value) || fabs (value) > 1e9)
+      return NAN;
+
+    seconds = seconds * 60 + trunc (value);
+  }
+
+  return seconds + offset;
+}
+
+/**
+ * px_pac_time_range_next_change:
+ * @argv: arguments of timeRange()
+ * @argc: number of arguments
+ * @now: current time in microseconds since the epoch
+ *
+ * The result of timeRange() can only change where one of its bounds starts
+ * or ends, or when the day changes.
+ *
+ * Returns: the first instant after @now at which the result of timeRange()
+ *   may differ from the one at @now
+ */
+gint64
+px_pac_time_range_next_change (const char * const *argv,
+                               int                 argc,
+                               gint64              now)
+{
+  double seconds[6] = { 0, 86399 };
+  guint n_seconds = 2;
+
+  if (argc > 0 && g_strcmp0 (argv[argc - 1], "GMT") == 0)
+    argc--;
+
+  if (argc == 1 || argc == 2) {
+    /* Compared with the hour, so fractions round either way */
+    for (int idx = 0; idx < argc; idx++) {
+      double hour = floor (px_pac_to_number (argv[idx]));
+
+      seconds[n_seconds++] = hour * 3600;
+      seconds[n_seconds++] = (hour + 1) * 3600;
+    }
+  } else if (argc == 4 || argc == 6) {
+    int middle = argc >> 1;
+
+    seconds[n_seconds++] = px_pac_time_of_day (argv, middle, 0);
+    seconds[n_seconds++] = px_pac_time_of_day (argv + middle, middle, middle == 2 ? 60 : 1);
+  }
+
+  return px_pac_next_times_of_day (now, seconds, n_seconds);
+}
+
+/*
+ * While an evaluation is tracked, the time predicates lower the tracked
+ * instant to the next one at which their result may change.
+ */
+static GPrivate px_pac_expiry = G_PRIVATE_INIT (NULL);
+
+/**
+ * px_duktape_natives_track_expiry:
+ * @expiry: (nullable): where to store the expiry, or %NULL to stop tracking
+ *
+ * Track the time predicates called on this thread from now on. @expiry is
+ * set to %G_MAXINT64 and lowered to the first instant, in microseconds
+ * since the epoch, at which the result of one of the calls may change.
+ */
+void
+px_duktape_natives_track_expiry (gint64 *expiry)
+{
+  if (expiry)
+    *expiry = G_MAXINT64;
+
+  g_private_set (&px_pac_expiry, expiry);
+}
+
+static void
+px_duktape_natives_expire_at (gint64 next_change)
+{
+  gint64 *expiry = g_private_get (&px_pac_expiry);
+
+  if (expiry)
+    *expiry = MIN (*expiry, next_change);
+}
+
+static gboolean
+px_duktape_natives_tracking (void)
+{
+  return g_private_get (&px_pac_expiry) != NULL;
+}
+
+/* Convert all arguments to strings, valid while they are on the stack */
+static const char **
+px_duktape_get_args (duk_context *ctx,
+                     int         *argc)
+{
+  const char **argv;
+
+  *argc = duk_get_top (ctx);
+  argv = g_new0 (const char *, *argc + 1);
+
+  for (int idx = 0; idx < *argc; idx++)
+    argv[idx] = duk_safe_to_string (ctx, idx);
+
+  return argv;
+}
+
+/* Call the JavaScript version of the running native instead */
+static duk_ret_t
+px_duktape_call_script (duk_context *ctx)
+{
+  duk_idx_t nargs = duk_get_top (ctx);
+
+  duk_push_current_function (ctx);
+  duk_get_prop_string (ctx, -1, PX_DUKTAPE_SCRIPT);
+  duk_remove (ctx, -2);
+  duk_insert (ctx, 0);
+  duk_call (ctx, nargs);
+
+  return 1;
+}
+
+/* The string at @idx, or %NULL if it is none or contains a NUL */
+static const char *
+px_duktape_get_plain_string (duk_context *ctx,
+                             duk_idx_t    idx)
+{
+  const char *str;
+  duk_size_t len;
+
+  if (!duk_is_string (ctx, idx))
+    return NULL;
+
+  str = duk_get_lstring (ctx, idx, &len);
+
+  return strlen (str) == len ? str : NULL;
+}
+
+static duk_ret_t
+sh_exp_match (duk_context *ctx)
+{
+  const char *str = px_duktape_get_plain_string (ctx, 0);
+  const char *pattern = px_duktape_get_plain_string (ctx, 1);
+
+  if (!str || !pattern || !px_pac_sh_exp_pattern_is_simple (pattern) || !px_pac_sh_exp_string_is_simple (str))
+    return px_duktape_call_script (ctx);
+
+  duk_push_boolean (ctx, px_pac_sh_exp_match (str, pattern));
+  return 1;
+}
+
+static duk_ret_t
+dns_domain_is (duk_context *ctx)
+{
+  const char *host = duk_safe_to_string (ctx, 0);
+  const char *domain = duk_safe_to_string (ctx, 1);
+
+  duk_push_boolean (ctx, px_pac_dns_domain_is (host, domain));
+  return 1;
+}
+
+/*
+ * Compile the list at @list_idx into a matcher and push it. The strings of
+ * the list are sized up first, so the trie can be built in place.
+ */
+static void
+px_duktape_matcher_build (duk_context *ctx,
+                          duk_idx_t    list_idx,
+                          gboolean     globs)
+{
+  duk_size_t length = duk_get_length (ctx, list_idx);
+  PxPacMatcher *matcher;
+  gsize nodes_size;
+  gsize total = 0;
+  gsize globs_size = 0;
+  char *glob_data;
+  guint8 *data;
+
+  for (duk_size_t idx = 0; idx < length; idx++) {
+    duk_get_prop_index (ctx, list_idx, idx);
+    total += strlen (duk_safe_to_string (ctx, -1)) + 1;
+    duk_pop (ctx);
+  }
+
+  if (length > G_MAXUINT32 || total >= G_MAXUINT32 / sizeof (PxPacMatcherNode))
+    duk_error (ctx, DUK_ERR_RANGE_ERROR, "list too long");
+
+  /* Every string adds at most one node or glob byte per character */
+  matcher = duk_push_fixed_buffer (ctx, sizeof (PxPacMatcher) + (total + 1) * sizeof (PxPacMatcherNode) + total);
+  glob_data = (char *)(px_pac_matcher_get_nodes (matcher) + total + 1);
+  memset (matcher, 0, sizeof (PxPacMatcher) + sizeof (PxPacMatcherNode));
+  matcher->length = length;
+  matcher->n_nodes = 1;
+
+  for (duk_size_t idx = 0; idx < length; idx++) {
+    const char *str;
+    gsize len;
+
+    duk_get_prop_index (ctx, list_idx, idx);
+    str = duk_safe_to_string (ctx, -1);
+    len = strlen (str);
+
+    /* Getters might not return the same strings twice */
+    if (len + 1 > total)
+      duk_error (ctx, DUK_ERR_ERROR, "list changed while compiling it");
+    total -= len + 1;
+
+    if (!globs) {
+      px_pac_matcher_add (matcher, str, PX_PAC_MATCHER_SUFFIX);
+    } else if (!strpbrk (str, "*?")) {
+      px_pac_matcher_add (matcher, str, PX_PAC_MATCHER_EXACT);
+    } else if (str[0] == '*' && !strpbrk (str + 1, "*?") && px_pac_is_ascii (str)) {
+      /* Like px_pac_sh_exp_match(), as long as no UTF-8 sequence is split */
+      px_pac_matcher_add (matcher, str + 1, PX_PAC_MATCHER_SUFFIX);
+    } else {
+      memcpy (glob_data + globs_size, str, len + 1);
+      globs_size += len + 1;
+      matcher->n_globs++;
+    }
+
+    duk_pop (ctx);
+  }
+
+  /* Copy into a buffer of the final size */
+  nodes_size = sizeof (PxPacMatcher) + matcher->n_nodes * sizeof (PxPacMatcherNode);
+  data = duk_push_fixed_buffer (ctx, nodes_size + globs_size);
+  memcpy (data, matcher, nodes_size);
+  memcpy (data + nodes_size, glob_data, globs_size);
+  duk_remove (ctx, -2);
+}
+
+/* Store the matcher on top of the stack in the list below it */
+static duk_ret_t
+px_duktape_matcher_store (duk_context *ctx,
+                          void        *udata)
+{
+  duk_put_prop_string (ctx, -2, udata);
+  return 0;
+}
+
+static duk_ret_t
+px_duktape_match_any (duk_context *ctx,
+                      gboolean     globs)
+{
+  const char *key = globs ? DUK_HIDDEN_SYMBOL ("pxPatternMatcher") : DUK_HIDDEN_SYMBOL ("pxDomainMatcher");
+  const char *host = duk_safe_to_string (ctx, 0);
+  PxPacMatcher *matcher;
+
+  if (!duk_is_object (ctx, 1)) {
+    duk_push_false (ctx);
+    return 1;
+  }
+
+  duk_get_prop_string (ctx, 1, key);
+  matcher = duk_get_buffer_data (ctx, -1, NULL);
+
+  if (!matcher || matcher->length != duk_get_length (ctx, 1)) {
+    duk_pop (ctx);
+    px_duktape_matcher_build (ctx, 1, globs);
+    matcher = duk_get_buffer_data (ctx, -1, NULL);
+
+    /* Lists which cannot be extended just do not keep their matcher */
+    duk_dup (ctx, 1);
+    duk_dup (ctx, -2);
+    duk_safe_call (ctx, px_duktape_matcher_store, (void *)key, 2, 1);
+    duk_pop (ctx);
+  }
+
+  duk_push_boolean (ctx, px_pac_matcher_match (matcher, host));
+  return 1;
+}
+
+static duk_ret_t
+dns_domain_is_any (duk_context *ctx)
+{
+  return px_duktape_match_any (ctx, FALSE);
+}
+
+static duk_ret_t
+sh_exp_match_any (duk_context *ctx)
+{
+  return px_duktape_match_any (ctx, TRUE);
+}
+
+static duk_ret_t
+local_host_or_domain_is (duk_context *ctx)
+{
+  const char *host = px_duktape_get_plain_string (ctx, 0);
+  const char *hostdom = px_duktape_get_plain_string (ctx, 1);
+
+  if (!host || !hostdom || (!strchr (host, '.') && strpbrk (host, "\\^$*+?()[]{}|")))
+    return px_duktape_call_script (ctx);
+
+  duk_push_boolean (ctx, px_pac_local_host_or_domain_is (host, hostdom));
+  return 1;
+}
+
+static duk_ret_t
+convert_addr (duk_context *ctx)
+{
+  duk_push_number (ctx, (gint32)px_pac_convert_addr (duk_safe_to_string (ctx, 0)));
+  return 1;
+}
+
+static duk_ret_t
+is_in_net (duk_context *ctx)
+{
+  const char *ipaddr = duk_safe_to_string (ctx, 0);
+  const char *pattern = duk_safe_to_string (ctx, 1);
+  const char *maskstr = duk_safe_to_string (ctx, 2);
+  guint32 host;
+  guint32 mask;
+  gboolean valid;
+
+  if (!px_pac_is_dotted_quad (ipaddr, &valid)) {
+    /* Resolve through dnsResolve() like the JavaScript version */
+    duk_get_global_string (ctx, "dnsResolve");
+    duk_dup (ctx, 0);
+    duk_call (ctx, 1);
+
+    if (duk_is_null_or_undefined (ctx, -1)) {
+      duk_push_false (ctx);
+      return 1;
+    }
+
+    ipaddr = duk_safe_to_string (ctx, -1);
+  } else if (!valid) {
+    duk_push_false (ctx);
+    return 1;
+  }
+
+  host = px_pac_convert_addr (ipaddr);
+  mask = px_pac_convert_addr (maskstr);
+
+  duk_push_boolean (ctx, (host & mask) == (px_pac_convert_addr (pattern) & mask));
+  return 1;
+}
+
+static duk_ret_t
+weekday_range (duk_context *ctx)
+{
+  g_autofree const char **argv = NULL;
+  gint64 now = g_get_real_time ();
+  int argc;
+
+  argv = px_duktape_get_args (ctx, &argc);
+  if (px_duktape_natives_tracking ())
+    px_duktape_natives_expire_at (px_pac_day_range_next_change (now));
+
+  duk_push_boolean (ctx, px_pac_weekday_range (argv, argc, now));
+  return 1;
+}
+
+static duk_ret_t
+date_range (duk_context *ctx)
+{
+  g_autofree const char **argv = NULL;
+  gint64 now = g_get_real_time ();
+  int argc;
+
+  argv = px_duktape_get_args (ctx, &argc);
+  if (px_duktape_natives_tracking ())
+    px_duktape_natives_expire_at (px_pac_day_range_next_change (now));
+
+  duk_push_boolean (ctx, px_pac_date_range (argv, argc, now));
+  return 1;
+}
+
+static duk_ret_t
+time_range (duk_context *ctx)
+{
+  const char **argv;
+  gint64 now = g_get_real_time ();
+  gboolean result;
+  gboolean ret;
+  int argc;
+
+  argv = px_duktape_get_args (ctx, &argc);
+  if (px_duktape_natives_tracking ())
+    px_duktape_natives_expire_at (px_pac_time_range_next_change (argv, argc, now));
+
+  ret = px_pac_time_range (argv, argc, now, &result);
+  g_free (argv);
+
+  if (!ret) {
+    duk_push_string (ctx, "timeRange: bad number of arguments");
+    return duk_throw (ctx);
+  }
+
+  duk_push_boolean (ctx, result);
+  return 1;
+}
+
+/**
+ * px_duktape_natives_register:
+ * @ctx: a duktape context
+ *
+ * Replace the JavaScript PAC helpers in the global object of @ctx with the
+ * native versions. Must be called after JAVASCRIPT_ROUTINES was evaluated.
+ */
+void
+px_duktape_natives_register (duk_context *ctx)
+{
+  static const struct {
+    const char *name;
+    duk_c_function func;
+    duk_idx_t nargs;
+    gboolean keep_script;
+  } natives[] = {
+    { "shExpMatch", sh_exp_match, 2, TRUE },
+    { "dnsDomainIs", dns_domain_is, 2, FALSE },
+    { "localHostOrDomainIs", local_host_or_domain_is, 2, TRUE },
+    { "convert_addr", convert_addr, 1, FALSE },
+    { "isInNet", is_in_net, 3, FALSE },
+    { "weekdayRange", weekday_range, DUK_VARARGS, FALSE },
+    { "dateRange", date_range, DUK_VARARGS, FALSE },
+    { "timeRange", time_range, DUK_VARARGS, FALSE },
+    { "dnsDomainIsAny", dns_domain_is_any, 2, FALSE },
+    { "shExpMatchAny", sh_exp_match_any, 2, FALSE },
+  };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (natives); idx++) {
+    duk_push_c_function (ctx, natives[idx].func, natives[idx].nargs);
+    if (natives[idx].keep_script) {
+      duk_get_global_string (ctx, natives[idx].name);
+      duk_put_prop_string (ctx, -2, PX_DUKTAPE_SCRIPT);
+    }
+    duk_put_global_string (ctx, natives[idx].name);
+  }
+}
+
+#ifdef PX_DUKTAPE_PRECOMPILED_ROUTINES
+/* Bytecode only works with the duktape version it was created with */
+static gboolean
+px_duktape_routines_load_bytecode (duk_context *ctx)
+{
+  duk_double_t version;
+  gboolean ret;
+
+  duk_get_global_string (ctx, "Duktape");
+  duk_get_prop_string (ctx, -1, "version");
+  version = duk_get_number (ctx, -1);
+  duk_pop_2 (ctx);
+
+  if (version != PX_DUKTAPE_ROUTINES_VERSION)
+    return FALSE;
+
+  memcpy (duk_push_fixed_buffer (ctx, sizeof (px_duktape_routines_bytecode)),
+          px_duktape_routines_bytecode,
+          sizeof (px_duktape_routines_bytecode));
+  duk_load_function (ctx);
+  ret = duk_pcall (ctx, 0) == 0;
+  duk_pop (ctx);
+
+  return ret;
+}
+#endif
+
+/**
+ * px_duktape_routines_load:
+ * @ctx: a duktape context
+ *
+ * Define the PAC helper functions in the global object of @ctx, using the
+ * bytecode compiled at build time if possible.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+px_duktape_routines_load (duk_context *ctx)
+{
+  gboolean ret = FALSE;
+
+#ifdef PX_DUKTAPE_PRECOMPILED_ROUTINES
+  ret = px_duktape_routines_load_bytecode (ctx);
+#endif
+
+  if (!ret && duk_peval_string_noresult (ctx, JAVASCRIPT_ROUTINES))
+    return FALSE;
+
+  px_duktape_natives_register (ctx);
+
+  return TRUE;
+}
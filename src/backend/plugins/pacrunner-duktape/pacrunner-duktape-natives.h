@@ -0,0 +1,73 @@
+/* pacrunner-duktape-natives.h
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "duktape.h"
+
+G_BEGIN_DECLS
+
+gboolean px_pac_sh_exp_pattern_is_simple (const char *pattern);
+
+gboolean px_pac_sh_exp_string_is_simple (const char *str);
+
+gboolean px_pac_sh_exp_match (const char *str,
+                              const char *pattern);
+
+gboolean px_pac_dns_domain_is (const char *host,
+                               const char *domain);
+
+gboolean px_pac_local_host_or_domain_is (const char *host,
+                                         const char *hostdom);
+
+guint32 px_pac_convert_addr (const char *ipchars);
+
+gboolean px_pac_is_dotted_quad (const char *ipaddr,
+                                gboolean   *valid);
+
+gboolean px_pac_weekday_range (const char * const *argv,
+                               int                 argc,
+                               gint64              now);
+
+gboolean px_pac_date_range (const char * const *argv,
+                            int                 argc,
+                            gint64              now);
+
+gboolean px_pac_time_range (const char * const *argv,
+                            int                 argc,
+                            gint64              now,
+                            gboolean           *result);
+
+gint64 px_pac_day_range_next_change (gint64 now);
+
+gint64 px_pac_time_range_next_change (const char * const *argv,
+                                      int                 argc,
+                                      gint64              now);
+
+void px_duktape_natives_track_expiry (gint64 *expiry);
+
+void px_duktape_natives_register (duk_context *ctx);
+
+gboolean px_duktape_routines_load (duk_context *ctx);
+
+G_END_DECLS
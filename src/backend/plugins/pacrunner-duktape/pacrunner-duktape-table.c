@@ -0,0 +1,618 @@
+/* pacrunner-duktape-table.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <string.h>
+
+#include "pacrunner-duktape-analysis.h"
+#include "pacrunner-duktape-natives.h"
+#include "pacrunner-duktape-table.h"
+
+/*
+ * Many PAC files are nothing but a list of
+ *
+ *   if (dnsDomainIs(host, "...") || shExpMatch(host, "...") || ...)
+ *     return "...";
+ *
+ * statements followed by a default return. Such PACs are compiled into a
+ * decision table, so looking up a host does not need the interpreter:
+ *
+ * - dnsDomainIs() domains and shExpMatch() patterns of the form "*suffix"
+ *   go into a trie of reversed suffixes,
+ * - shExpMatch() patterns without wildcards into a table of host names,
+ * - isInNet() networks into one table per netmask,
+ * - and all other shExpMatch() patterns into a list.
+ *
+ * Each if statement is a rule, and a host gets the result of the first
+ * rule it matches. isInNet() resolves hosts which are not IP addresses, so
+ * the table has no answer for those if such a rule comes before the first
+ * match, and the PAC has to be run instead.
+ *
+ * Conditions are matched with the native helpers, which are what the PAC
+ * would call as well. shExpMatch() patterns with regular expression syntax
+ * are not supported, and neither are hosts the native shExpMatch() passes
+ * on to the JavaScript version. Anything else in the PAC, even an unused variable,
+ * makes the compilation fail.
+ */
+
+#define PX_PAC_TABLE_NO_RULE G_MAXUINT
+#define PX_PAC_TABLE_MAX_NESTING 16
+
+typedef struct {
+  guint first_child;
+  guint next_sibling;
+  guint rule;
+  char c;
+} PxPacTableNode;
+
+typedef struct {
+  char *pattern;
+  guint rule;
+} PxPacTableGlob;
+
+typedef struct {
+  guint32 mask;
+  GHashTable *networks;
+} PxPacTableNetmask;
+
+struct _PxPacTable {
+  gatomicrefcount ref_count;
+
+  GPtrArray *results;
+  char *default_result;
+
+  GArray *suffixes;
+  GHashTable *hosts;
+  GArray *globs;
+  GArray *netmasks;
+  guint plain_rule;
+  guint resolve_rule;
+};
+
+static const char *predicates[] = { "dnsDomainIs", "shExpMatch", "isInNet", "isPlainHostName", NULL };
+
+static void
+px_pac_table_glob_clear (PxPacTableGlob *glob)
+{
+  g_free (glob->pattern);
+}
+
+static void
+px_pac_table_netmask_clear (PxPacTableNetmask *netmask)
+{
+  g_hash_table_unref (netmask->networks);
+}
+
+static PxPacTable *
+px_pac_table_new (void)
+{
+  PxPacTable *self = g_new0 (PxPacTable, 1);
+  PxPacTableNode root = { 0, 0, PX_PAC_TABLE_NO_RULE, '\0' };
+
+  g_atomic_ref_count_init (&self->ref_count);
+  self->results = g_ptr_array_new_with_free_func (g_free);
+  self->suffixes = g_array_new (FALSE, FALSE, sizeof (PxPacTableNode));
+  g_array_append_val (self->suffixes, root);
+  self->hosts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->globs = g_array_new (FALSE, FALSE, sizeof (PxPacTableGlob));
+  g_array_set_clear_func (self->globs, (GDestroyNotify)px_pac_table_glob_clear);
+  self->netmasks = g_array_new (FALSE, FALSE, sizeof (PxPacTableNetmask));
+  g_array_set_clear_func (self->netmasks, (GDestroyNotify)px_pac_table_netmask_clear);
+  self->plain_rule = PX_PAC_TABLE_NO_RULE;
+  self->resolve_rule = PX_PAC_TABLE_NO_RULE;
+
+  return self;
+}
+
+/**
+ * px_pac_table_ref:
+ * @self: a `PxPacTable`
+ *
+ * Returns: (transfer full): @self
+ */
+PxPacTable *
+px_pac_table_ref (PxPacTable *self)
+{
+  g_atomic_ref_count_inc (&self->ref_count);
+
+  return self;
+}
+
+/**
+ * px_pac_table_unref:
+ * @self: a `PxPacTable`
+ *
+ * Drop a reference, freeing the table once the last one is gone.
+ */
+void
+px_pac_table_unref (PxPacTable *self)
+{
+  if (!g_atomic_ref_count_dec (&self->ref_count))
+    return;
+
+  g_ptr_array_unref (self->results);
+  g_free (self->default_result);
+  g_array_unref (self->suffixes);
+  g_hash_table_unref (self->hosts);
+  g_array_unref (self->globs);
+  g_array_unref (self->netmasks);
+  g_free (self);
+}
+
+/* Returns the child of @node for @c, or 0 if there is none */
+static guint
+px_pac_table_get_child (PxPacTable *self,
+                        guint       node,
+                        char        c)
+{
+  guint child = g_array_index (self->suffixes, PxPacTableNode, node).first_child;
+
+  while (child != 0) {
+    PxPacTableNode *child_node = &g_array_index (self->suffixes, PxPacTableNode, child);
+
+    if (child_node->c == c)
+      return child;
+
+    child = child_node->next_sibling;
+  }
+
+  return 0;
+}
+
+static void
+px_pac_table_add_suffix (PxPacTable *self,
+                         const char *suffix,
+                         guint       rule)
+{
+  PxPacTableNode *last;
+  guint node = 0;
+
+  for (gsize idx = strlen (suffix); idx > 0; idx--) {
+    guint child = px_pac_table_get_child (self, node, suffix[idx - 1]);
+
+    if (child == 0) {
+      PxPacTableNode *parent = &g_array_index (self->suffixes, PxPacTableNode, node);
+      PxPacTableNode new_node = { 0, parent->first_child, PX_PAC_TABLE_NO_RULE, suffix[idx - 1] };
+
+      child = self->suffixes->len;
+      parent->first_child = child;
+      g_array_append_val (self->suffixes, new_node);
+    }
+
+    node = child;
+  }
+
+  last = &g_array_index (self->suffixes, PxPacTableNode, node);
+  last->rule = MIN (last->rule, rule);
+}
+
+static void
+px_pac_table_add_host (PxPacTable *self,
+                       const char *host,
+                       guint       rule)
+{
+  /* Rules are added in order, so the first one wins */
+  if (!g_hash_table_contains (self->hosts, host))
+    g_hash_table_insert (self->hosts, g_strdup (host), GUINT_TO_POINTER (rule + 1));
+}
+
+static gboolean
+px_pac_table_is_ascii (const char *str)
+{
+  for (; *str; str++) {
+    if ((guchar)*str >= 0x80)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+px_pac_table_add_glob (PxPacTable *self,
+                       const char *pattern,
+                       guint       rule)
+{
+  PxPacTableGlob glob;
+
+  if (!strpbrk (pattern, "*?")) {
+    px_pac_table_add_host (self, pattern, rule);
+    return;
+  }
+
+  /* Backtracking steps over whole characters, so suffixes must be ASCII */
+  if (pattern[0] == '*' && !strpbrk (pattern + 1, "*?") && px_pac_table_is_ascii (pattern)) {
+    px_pac_table_add_suffix (self, pattern + 1, rule);
+    return;
+  }
+
+  glob.pattern = g_strdup (pattern);
+  glob.rule = rule;
+  g_array_append_val (self->globs, glob);
+}
+
+static void
+px_pac_table_add_network (PxPacTable *self,
+                          const char *pattern,
+                          const char *maskstr,
+                          guint       rule)
+{
+  guint32 mask = px_pac_convert_addr (maskstr);
+  gpointer network = GUINT_TO_POINTER (px_pac_convert_addr (pattern) & mask);
+  PxPacTableNetmask *netmask = NULL;
+
+  self->resolve_rule = MIN (self->resolve_rule, rule);
+
+  for (guint idx = 0; idx < self->netmasks->len && !netmask; idx++) {
+    if (g_array_index (self->netmasks, PxPacTableNetmask, idx).mask == mask)
+      netmask = &g_array_index (self->netmasks, PxPacTableNetmask, idx);
+  }
+
+  if (!netmask) {
+    PxPacTableNetmask new_netmask = { mask, g_hash_table_new (NULL, NULL) };
+
+    g_array_append_val (self->netmasks, new_netmask);
+    netmask = &g_array_index (self->netmasks, PxPacTableNetmask, self->netmasks->len - 1);
+  }
+
+  if (!g_hash_table_contains (netmask->networks, network))
+    g_hash_table_insert (netmask->networks, network, GUINT_TO_POINTER (rule + 1));
+}
+
+typedef struct {
+  GArray *tokens;
+  guint pos;
+  PxJsToken *host;
+  PxPacTable *table;
+} PxPacTableParser;
+
+static PxJsToken *
+px_pac_table_parser_peek (PxPacTableParser *parser)
+{
+  if (parser->pos >= parser->tokens->len)
+    return NULL;
+
+  return &g_array_index (parser->tokens, PxJsToken, parser->pos);
+}
+
+static gboolean
+px_pac_table_parser_accept (PxPacTableParser *parser,
+                            const char       *str)
+{
+  if (!px_js_token_is (px_pac_table_parser_peek (parser), str))
+    return FALSE;
+
+  parser->pos++;
+  return TRUE;
+}
+
+static gboolean
+px_pac_table_parser_accept_host (PxPacTableParser *parser)
+{
+  PxJsToken *token = px_pac_table_parser_peek (parser);
+
+  if (!token || token->type != PX_JS_IDENTIFIER || token->len != parser->host->len ||
+      strncmp (token->start, parser->host->start, token->len) != 0)
+    return FALSE;
+
+  parser->pos++;
+  return TRUE;
+}
+
+/* Returns the value of a string literal without escapes, or %NULL */
+static char *
+px_pac_table_parser_accept_string (PxPacTableParser *parser)
+{
+  PxJsToken *token = px_pac_table_parser_peek (parser);
+
+  if (!token || token->type != PX_JS_LITERAL || (token->start[0] != '"' && token->start[0] != '\''))
+    return NULL;
+
+  if (memchr (token->start, '\\', token->len))
+    return NULL;
+
+  parser->pos++;
+  return g_strndup (token->start + 1, token->len - 2);
+}
+
+/* predicate(host [, "string" [, "string"]]) */
+static gboolean
+px_pac_table_parse_call (PxPacTableParser *parser,
+                         guint             rule)
+{
+  PxJsToken *name = px_pac_table_parser_peek (parser);
+  g_autofree char *arg = NULL;
+  g_autofree char *maskstr = NULL;
+
+  if (!px_js_token_is_one_of (name, predicates))
+    return FALSE;
+  parser->pos++;
+
+  if (!px_pac_table_parser_accept (parser, "(") || !px_pac_table_parser_accept_host (parser))
+    return FALSE;
+
+  if (px_js_token_is (name, "isPlainHostName")) {
+    parser->table->plain_rule = MIN (parser->table->plain_rule, rule);
+    return px_pac_table_parser_accept (parser, ")");
+  }
+
+  if (!px_pac_table_parser_accept (parser, ",") || !(arg = px_pac_table_parser_accept_string (parser)))
+    return FALSE;
+
+  if (px_js_token_is (name, "dnsDomainIs")) {
+    px_pac_table_add_suffix (parser->table, arg, rule);
+  } else if (px_js_token_is (name, "shExpMatch")) {
+    /* Anything else needs regular expressions */
+    if (!px_pac_sh_exp_pattern_is_simple (arg))
+      return FALSE;
+
+    px_pac_table_add_glob (parser->table, arg, rule);
+  } else {
+    if (!px_pac_table_parser_accept (parser, ",") || !(maskstr = px_pac_table_parser_accept_string (parser)))
+      return FALSE;
+
+    px_pac_table_add_network (parser->table, arg, maskstr, rule);
+  }
+
+  return px_pac_table_parser_accept (parser, ")");
+}
+
+/* Calls joined by ||, optionally in parentheses */
+static gboolean
+px_pac_table_parse_condition (PxPacTableParser *parser,
+                              guint             rule,
+                              guint             nesting)
+{
+  if (nesting > PX_PAC_TABLE_MAX_NESTING)
+    return FALSE;
+
+  do {
+    if (px_pac_table_parser_accept (parser, "(")) {
+      if (!px_pac_table_parse_condition (parser, rule, nesting + 1) || !px_pac_table_parser_accept (parser, ")"))
+        return FALSE;
+    } else if (!px_pac_table_parse_call (parser, rule)) {
+      return FALSE;
+    }
+  } while (px_pac_table_parser_accept (parser, "||"));
+
+  return TRUE;
+}
+
+/* return "string", with an optional semicolon */
+static char *
+px_pac_table_parse_return (PxPacTableParser *parser)
+{
+  char *result;
+
+  if (!px_pac_table_parser_accept (parser, "return"))
+    return NULL;
+
+  result = px_pac_table_parser_accept_string (parser);
+  if (result)
+    px_pac_table_parser_accept (parser, ";");
+
+  return result;
+}
+
+/* The if statements and the default return of FindProxyForURL() */
+static gboolean
+px_pac_table_parse_body (PxPacTableParser *parser)
+{
+  PxPacTable *table = parser->table;
+  gboolean after_if = FALSE;
+
+  while (!px_pac_table_parser_accept (parser, "}")) {
+    gboolean braces;
+    char *result;
+
+    if (px_pac_table_parser_accept (parser, ";")) {
+      after_if = FALSE;
+      continue;
+    }
+
+    /* Every branch returns, so else does not change anything */
+    if (px_pac_table_parser_accept (parser, "else") && !after_if)
+      return FALSE;
+
+    if (!px_pac_table_parser_accept (parser, "if")) {
+      table->default_result = px_pac_table_parse_return (parser);
+
+      return table->default_result && px_pac_table_parser_accept (parser, "}");
+    }
+
+    if (!px_pac_table_parser_accept (parser, "(") ||
+        !px_pac_table_parse_condition (parser, table->results->len, 0) ||
+        !px_pac_table_parser_accept (parser, ")"))
+      return FALSE;
+
+    braces = px_pac_table_parser_accept (parser, "{");
+    result = px_pac_table_parse_return (parser);
+    if (!result)
+      return FALSE;
+
+    g_ptr_array_add (table->results, result);
+    if (braces && !px_pac_table_parser_accept (parser, "}"))
+      return FALSE;
+
+    after_if = TRUE;
+  }
+
+  /* Falling off the end returns undefined, which means no proxy */
+  table->default_result = g_strdup ("");
+
+  return TRUE;
+}
+
+/* function FindProxyForURL(url, host) { ... } and nothing else */
+static gboolean
+px_pac_table_parse (PxPacTableParser *parser)
+{
+  PxJsToken *url;
+
+  if (!px_pac_table_parser_accept (parser, "function") ||
+      !px_pac_table_parser_accept (parser, "FindProxyForURL") ||
+      !px_pac_table_parser_accept (parser, "("))
+    return FALSE;
+
+  url = px_pac_table_parser_peek (parser);
+  if (!url || url->type != PX_JS_IDENTIFIER || px_js_token_is_one_of (url, predicates))
+    return FALSE;
+  parser->pos++;
+
+  if (!px_pac_table_parser_accept (parser, ","))
+    return FALSE;
+
+  parser->host = px_pac_table_parser_peek (parser);
+  if (!parser->host || parser->host->type != PX_JS_IDENTIFIER || px_js_token_is_one_of (parser->host, predicates))
+    return FALSE;
+
+  /* Would refer to the url instead */
+  if (url->len == parser->host->len && strncmp (url->start, parser->host->start, url->len) == 0)
+    return FALSE;
+  parser->pos++;
+
+  if (!px_pac_table_parser_accept (parser, ")") || !px_pac_table_parser_accept (parser, "{"))
+    return FALSE;
+
+  return px_pac_table_parse_body (parser) && parser->pos == parser->tokens->len;
+}
+
+/**
+ * px_pac_table_compile:
+ * @source: the PAC file
+ * @len: length of @source
+ *
+ * Compile @source into a decision table, if it only consists of rules the
+ * table supports.
+ *
+ * Returns: (transfer full) (nullable): the table, or %NULL if @source has
+ *   to be run by the interpreter
+ */
+PxPacTable *
+px_pac_table_compile (const char *source,
+                      gsize       len)
+{
+  g_autoptr (GArray) tokens = g_array_new (FALSE, FALSE, sizeof (PxJsToken));
+  g_autoptr (PxPacTable) table = px_pac_table_new ();
+  PxPacTableParser parser = { tokens, 0, NULL, table };
+
+  if (!px_js_tokenize (source, len, tokens) || !px_pac_table_parse (&parser))
+    return NULL;
+
+  return g_steal_pointer (&table);
+}
+
+/**
+ * px_pac_table_get_n_rules:
+ * @self: a `PxPacTable`
+ *
+ * Returns: the number of rules, not counting the default
+ */
+guint
+px_pac_table_get_n_rules (PxPacTable *self)
+{
+  return self->results->len;
+}
+
+/* Parse an address px_pac_is_dotted_quad() found valid */
+static guint32
+px_pac_table_parse_address (const char *host)
+{
+  guint32 address = 0;
+  guint32 part = 0;
+
+  for (; *host; host++) {
+    if (*host == '.') {
+      address = (address << 8) | part;
+      part = 0;
+    } else {
+      part = part * 10 + g_ascii_digit_value (*host);
+    }
+  }
+
+  return (address << 8) | part;
+}
+
+/**
+ * px_pac_table_lookup:
+ * @self: a `PxPacTable`
+ * @host: host name
+ *
+ * Find the result of FindProxyForURL() for @host.
+ *
+ * Returns: (nullable): the result, or %NULL if the PAC has to be run
+ */
+const char *
+px_pac_table_lookup (PxPacTable *self,
+                     const char *host)
+{
+  guint best = g_array_index (self->suffixes, PxPacTableNode, 0).rule;
+  guint node = 0;
+  gpointer rule;
+  gboolean valid;
+
+  /* Patterns would not match such hosts like a regular expression does */
+  if (!px_pac_sh_exp_string_is_simple (host))
+    return NULL;
+
+  for (gsize idx = strlen (host); idx > 0; idx--) {
+    node = px_pac_table_get_child (self, node, host[idx - 1]);
+    if (node == 0)
+      break;
+
+    best = MIN (best, g_array_index (self->suffixes, PxPacTableNode, node).rule);
+  }
+
+  rule = g_hash_table_lookup (self->hosts, host);
+  if (rule)
+    best = MIN (best, GPOINTER_TO_UINT (rule) - 1);
+
+  if (self->plain_rule < best && !strchr (host, '.'))
+    best = self->plain_rule;
+
+  /* Only globs of earlier rules can change the result */
+  for (guint idx = 0; idx < self->globs->len; idx++) {
+    PxPacTableGlob *glob = &g_array_index (self->globs, PxPacTableGlob, idx);
+
+    if (glob->rule >= best)
+      break;
+
+    if (px_pac_sh_exp_match (host, glob->pattern)) {
+      best = glob->rule;
+      break;
+    }
+  }
+
+  if (px_pac_is_dotted_quad (host, &valid)) {
+    guint32 address = valid ? px_pac_table_parse_address (host) : 0;
+
+    /* Invalid addresses are in no network */
+    for (guint idx = 0; valid && idx < self->netmasks->len; idx++) {
+      PxPacTableNetmask *netmask = &g_array_index (self->netmasks, PxPacTableNetmask, idx);
+
+      rule = g_hash_table_lookup (netmask->networks, GUINT_TO_POINTER (address & netmask->mask));
+      if (rule)
+        best = MIN (best, GPOINTER_TO_UINT (rule) - 1);
+    }
+  } else if (self->resolve_rule < best) {
+    return NULL;
+  }
+
+  return best < self->results->len ? g_ptr_array_index (self->results, best) : self->default_result;
+}
@@ -0,0 +1,44 @@
+/* pacrunner-duktape-table.h
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PxPacTable PxPacTable;
+
+PxPacTable *px_pac_table_compile (const char *source,
+                                  gsize       len);
+
+PxPacTable *px_pac_table_ref (PxPacTable *self);
+
+void px_pac_table_unref (PxPacTable *self);
+
+guint px_pac_table_get_n_rules (PxPacTable *self);
+
+const char *px_pac_table_lookup (PxPacTable *self,
+                                 const char *host);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PxPacTable, px_pac_table_unref)
+
+G_END_DECLS
@@ -21,23 +21,101 @@
 
 #include <gio/gio.h>
 
+#include <string.h>
 #include <unistd.h>
 #ifdef __WIN32__
 #include <ws2tcpip.h>
 #else
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
 #include "pacrunner-duktape.h"
-#include "pacutils.h"
+#include "pacrunner-duktape-analysis.h"
+#include "pacrunner-duktape-arena.h"
+#include "pacrunner-duktape-natives.h"
+#include "pacrunner-duktape-table.h"
+#include "px-lru-cache.h"
 #include "px-plugin-pacrunner.h"
 
 #include "duktape.h"
 
+/*
+ * A duktape heap is single threaded, so concurrent lookups each check out
+ * their own heap from the pool. Heaps are created on demand up to the pool
+ * size and load the current PAC lazily when they are checked out.
+ *
+ * Evaluations get a time budget. Once it is used up every allocation fails,
+ * which makes duktape throw, and duktapes built with
+ * DUK_USE_EXEC_TIMEOUT_CHECK(udata) defined to
+ * px_duktape_exec_timeout_check(udata) also interrupt loops which do not
+ * allocate. Heaps which ran out of time are destroyed. Other duktapes,
+ * including stock builds, never return from such loops: the calling thread
+ * and its heap stay busy for good. Waiting for a heap is limited to the
+ * budget as well, so other lookups fail instead of hanging once all heaps
+ * are stuck.
+ *
+ * Each heap allocates from its own arena, which caps the memory a PAC can
+ * use. Heaps which failed to allocate are destroyed as well, as they may be
+ * left in a state where every further evaluation fails. Calls which may
+ * allocate are therefore protected, so running out of memory does not end
+ * up in duktape's fatal error handler.
+ *
+ * The global object of the heap's main context holds the helpers and is
+ * never touched by a PAC. Each PAC runs in a thread with a fresh global
+ * environment the helpers are copied into, and loading another PAC drops
+ * that thread, so reloads do not accumulate the globals of earlier PACs.
+ */
+typedef struct {
+  duk_context *ctx;
+  duk_context *pac_ctx;
+  PxDuktapeArena *arena;
+  guint pac_serial;
+  gboolean exhausted;
+  gsize reported_used;
+  /* Duktape.version of the library in use */
+  long version;
+
+  guint timeout;
+  gint64 deadline;
+  gboolean timed_out;
+  gint64 expiry;
+} PxDuktapeHeap;
+
 struct _PxPacRunnerDuktape {
   GObject parent_instance;
-  duk_context *ctx;
+
+  guint pool_size;
+  char *cache_dir;
+  guint timeout;
+  guint64 memory_limit;
+
+  GMutex mutex;
+  GCond cond;
+  GPtrArray *idle_heaps;
+  guint n_heaps;
+  guint64 memory_used;
+  guint64 memory_peak;
+
+  GBytes *pac_bytecode;
+  guint pac_serial;
+  gboolean pac_memoizable;
+  PxLruCache *memo;
+  PxPacTable *pac_table;
+};
+
+enum {
+  PROP_0,
+  PROP_POOL_SIZE,
+  PROP_CACHE_DIR,
+  PROP_TIMEOUT,
+  PROP_MEMORY_LIMIT,
+  PROP_MEMORY_USED,
+  PROP_MEMORY_PEAK,
 };
 
 static void px_pacrunner_iface_init (PxPacRunnerInterface *iface);
@@ -48,26 +126,55 @@ G_DEFINE_FINAL_TYPE_WITH_CODE (PxPacRunnerDuktape,
                                G_IMPLEMENT_INTERFACE (PX_TYPE_PACRUNNER, px_pacrunner_iface_init))
 
 
-static duk_ret_t
-dns_resolve (duk_context *ctx)
+/*
+ * PAC files tend to resolve the host of every url, so results are shared by
+ * all heaps of all runners in the process. Failed lookups are remembered for
+ * a shorter time, as they are more likely to be caused by a transient
+ * problem. The cache is flushed when the network changes.
+ */
+#define PX_DNS_CACHE_SIZE 256
+#define PX_DNS_CACHE_TTL (60 * G_TIME_SPAN_SECOND)
+#define PX_DNS_CACHE_NEGATIVE_TTL (10 * G_TIME_SPAN_SECOND)
+
+static PxLruCache *
+px_dns_cache_get (void)
+{
+  static gsize dns_cache = 0;
+
+  if (g_once_init_enter (&dns_cache))
+    g_once_init_leave (&dns_cache, (gsize)px_lru_cache_new (PX_DNS_CACHE_SIZE, (GBoxedCopyFunc)g_strdup, g_free));
+
+  return (PxLruCache *)dns_cache;
+}
+
+/*
+ * Resolve @hostname to a numeric address.
+ *
+ * Returns: (transfer full) (nullable): the address or %NULL if it could not
+ *   be resolved
+ */
+static char *
+px_dns_lookup (const char *hostname)
 {
-  const char *hostname = NULL;
   struct addrinfo *info;
   char tmp[INET6_ADDRSTRLEN + 1];
+  char *address;
 
-  if (duk_get_top (ctx) != 1) {
-    /* Invalid number of arguments */
-    return 0;
-  }
+  /* Negative results are cached as empty strings */
+  address = px_lru_cache_lookup (px_dns_cache_get (), hostname);
+  if (address) {
+    if (*address)
+      return address;
 
-  /* We do not need to free the string - It's managed by Duktape. */
-  hostname = duk_get_string (ctx, 0);
-  if (!hostname)
-    return 0;
+    g_free (address);
+    return NULL;
+  }
 
   /* Look it up */
-  if (getaddrinfo (hostname, NULL, NULL, &info))
-    return 0;
+  if (getaddrinfo (hostname, NULL, NULL, &info)) {
+    px_lru_cache_insert (px_dns_cache_get (), hostname, g_strdup (""), g_get_monotonic_time () + PX_DNS_CACHE_NEGATIVE_TTL);
+    return NULL;
+  }
 
   /* Try for IPv4 */
   if (getnameinfo (info->ai_addr,
@@ -78,30 +185,220 @@ dns_resolve (duk_context *ctx)
                    0,
                    NI_NUMERICHOST)) {
     freeaddrinfo (info);
+    px_lru_cache_insert (px_dns_cache_get (), hostname, g_strdup (""), g_get_monotonic_time () + PX_DNS_CACHE_NEGATIVE_TTL);
+    return NULL;
+  }
+  freeaddrinfo (info);
+
+  px_lru_cache_insert (px_dns_cache_get (), hostname, g_strdup (tmp), g_get_monotonic_time () + PX_DNS_CACHE_TTL);
+
+  return g_strdup (tmp);
+}
+
+static duk_ret_t
+dns_resolve (duk_context *ctx)
+{
+  const char *hostname = NULL;
+  g_autofree char *address = NULL;
+
+  if (duk_get_top (ctx) != 1) {
+    /* Invalid number of arguments */
+    return 0;
+  }
+
+  /* We do not need to free the string - It's managed by Duktape. */
+  hostname = duk_get_string (ctx, 0);
+  if (!hostname)
+    return 0;
+
+  address = px_dns_lookup (hostname);
+  if (!address) {
     duk_push_null (ctx);
     return 1;
   }
-  freeaddrinfo (info);
 
   /* Create the return value */
-  duk_push_string (ctx, tmp);
+  duk_push_string (ctx, address);
 
   return 1;
 }
 
+/*
+ * The local addresses only change with the network configuration, so they
+ * are computed once and dropped when the network changes.
+ */
+static GMutex my_ip_mutex;
+static char *my_ip;
+static char *my_ip_ex;
+
+static char *
+px_sockaddr_to_string (const struct sockaddr *addr,
+                       socklen_t              len)
+{
+  char tmp[INET6_ADDRSTRLEN + 1];
+
+  if (getnameinfo (addr, len, tmp, sizeof (tmp), NULL, 0, NI_NUMERICHOST))
+    return NULL;
+
+  return g_strdup (tmp);
+}
+
+/*
+ * Find the address of the interface holding the route to @target by
+ * connecting a UDP socket. This does not send any packets.
+ */
+static char *
+px_route_source_address (int         family,
+                         const char *target)
+{
+  struct sockaddr_storage addr = { 0, };
+  socklen_t len;
+  char *address = NULL;
+  int fd;
+
+  if (family == AF_INET) {
+    struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons (53);
+    len = sizeof (*sin);
+    if (inet_pton (AF_INET, target, &sin->sin_addr) != 1)
+      return NULL;
+  } else {
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons (53);
+    len = sizeof (*sin6);
+    if (inet_pton (AF_INET6, target, &sin6->sin6_addr) != 1)
+      return NULL;
+  }
+
+  fd = socket (family, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return NULL;
+
+  if (connect (fd, (struct sockaddr *)&addr, len) == 0) {
+    len = sizeof (addr);
+    if (getsockname (fd, (struct sockaddr *)&addr, &len) == 0)
+      address = px_sockaddr_to_string ((struct sockaddr *)&addr, len);
+  }
+
+#ifdef __WIN32__
+  closesocket (fd);
+#else
+  close (fd);
+#endif
+
+  return address;
+}
+
+/*
+ * Collect the addresses of all interfaces which are up, except loopback,
+ * with IPv4 addresses first.
+ */
+static GPtrArray *
+px_interface_addresses (void)
+{
+  GPtrArray *addresses = g_ptr_array_new_with_free_func (g_free);
+#ifndef __WIN32__
+  struct ifaddrs *ifaddr;
+
+  if (getifaddrs (&ifaddr) != 0)
+    return addresses;
+
+  for (int family = AF_INET; family; family = family == AF_INET ? AF_INET6 : 0) {
+    for (struct ifaddrs *ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+      char *address;
+
+      if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family)
+        continue;
+
+      if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_LOOPBACK))
+        continue;
+
+      address = px_sockaddr_to_string (ifa->ifa_addr,
+                                       family == AF_INET ? sizeof (struct sockaddr_in) : sizeof (struct sockaddr_in6));
+      if (address)
+        g_ptr_array_add (addresses, address);
+    }
+  }
+
+  freeifaddrs (ifaddr);
+#endif
+
+  return addresses;
+}
+
+/* Must be called with my_ip_mutex held */
+static void
+px_my_ip_update (void)
+{
+  g_autoptr (GPtrArray) addresses = NULL;
+  g_autoptr (GStrvBuilder) builder = NULL;
+  g_auto (GStrv) list = NULL;
+  g_autofree char *address = NULL;
+
+  if (my_ip)
+    return;
+
+  addresses = px_interface_addresses ();
+
+  /* Prefer the interface holding the default route */
+  my_ip = px_route_source_address (AF_INET, "192.0.2.1");
+  if (!my_ip && addresses->len > 0 && !strchr (g_ptr_array_index (addresses, 0), ':'))
+    my_ip = g_strdup (g_ptr_array_index (addresses, 0));
+  if (!my_ip)
+    my_ip = g_strdup ("127.0.0.1");
+
+  /* myIpAddressEx() lists the default route addresses first */
+  builder = g_strv_builder_new ();
+  g_strv_builder_add (builder, my_ip);
+
+  address = px_route_source_address (AF_INET6, "2001:db8::1");
+  if (address)
+    g_strv_builder_add (builder, address);
+
+  for (guint idx = 0; idx < addresses->len; idx++) {
+    const char *candidate = g_ptr_array_index (addresses, idx);
+
+    if (g_strcmp0 (candidate, my_ip) != 0 && g_strcmp0 (candidate, address) != 0)
+      g_strv_builder_add (builder, candidate);
+  }
+
+  list = g_strv_builder_end (builder);
+  my_ip_ex = g_strjoinv (";", list);
+}
+
+static void
+px_my_ip_reset (void)
+{
+  g_mutex_lock (&my_ip_mutex);
+  g_clear_pointer (&my_ip, g_free);
+  g_clear_pointer (&my_ip_ex, g_free);
+  g_mutex_unlock (&my_ip_mutex);
+}
+
 static duk_ret_t
 my_ip_address (duk_context *ctx)
 {
-  char hostname[1024];
+  g_mutex_lock (&my_ip_mutex);
+  px_my_ip_update ();
+  duk_push_string (ctx, my_ip);
+  g_mutex_unlock (&my_ip_mutex);
 
-  hostname[sizeof (hostname) - 1] = '\0';
+  return 1;
+}
 
-  if (!gethostname (hostname, sizeof (hostname) - 1)) {
-    duk_push_string (ctx, hostname);
-    return dns_resolve (ctx);
-  }
+static duk_ret_t
+my_ip_address_ex (duk_context *ctx)
+{
+  g_mutex_lock (&my_ip_mutex);
+  px_my_ip_update ();
+  duk_push_string (ctx, my_ip_ex);
+  g_mutex_unlock (&my_ip_mutex);
 
-  return duk_error (ctx, DUK_ERR_ERROR, "Unable to find hostname!");
+  return 1;
 }
 
 static duk_ret_t
@@ -123,29 +420,605 @@ alert (duk_context *ctx)
 }
 
 static void
-px_pacrunner_duktape_init (PxPacRunnerDuktape *self)
+px_duktape_heap_free (PxDuktapeHeap *heap)
 {
-  self->ctx = duk_create_heap_default ();
-  if (!self->ctx)
-    return;
+  g_clear_pointer (&heap->ctx, duk_destroy_heap);
+  g_clear_pointer (&heap->arena, px_duktape_arena_free);
+  g_free (heap);
+}
+
+static gboolean
+px_duktape_heap_expired (PxDuktapeHeap *heap)
+{
+  if (heap->deadline == 0)
+    return FALSE;
+
+  if (g_get_monotonic_time () > heap->deadline)
+    heap->timed_out = TRUE;
+
+  return heap->timed_out;
+}
+
+#ifdef DUK_USE_EXEC_TIMEOUT_CHECK
+duk_bool_t px_duktape_exec_timeout_check (void *udata);
+
+duk_bool_t
+px_duktape_exec_timeout_check (void *udata)
+{
+  return udata && px_duktape_heap_expired (udata);
+}
+#endif
+
+static void *
+px_duktape_alloc (void       *udata,
+                  duk_size_t  size)
+{
+  PxDuktapeHeap *heap = udata;
+  void *ptr;
+
+  if (px_duktape_heap_expired (heap))
+    return NULL;
+
+  ptr = px_duktape_arena_alloc (heap->arena, size);
+  if (!ptr && size > 0)
+    heap->exhausted = TRUE;
+
+  return ptr;
+}
+
+static void *
+px_duktape_realloc (void       *udata,
+                    void       *ptr,
+                    duk_size_t  size)
+{
+  PxDuktapeHeap *heap = udata;
+  void *new_ptr;
+
+  /* Let duktape give memory back even when out of time */
+  if (size > 0 && (!ptr || size > px_duktape_arena_get_size (heap->arena, ptr)) && px_duktape_heap_expired (heap))
+    return NULL;
+
+  new_ptr = px_duktape_arena_realloc (heap->arena, ptr, size);
+  if (!new_ptr && size > 0)
+    heap->exhausted = TRUE;
+
+  return new_ptr;
+}
+
+static void
+px_duktape_free (void *udata,
+                 void *ptr)
+{
+  PxDuktapeHeap *heap = udata;
+
+  px_duktape_arena_release (heap->arena, ptr);
+}
+
+static void
+px_duktape_heap_start_budget (PxDuktapeHeap *heap)
+{
+  heap->timed_out = FALSE;
+  if (heap->timeout > 0)
+    heap->deadline = g_get_monotonic_time () + heap->timeout * G_TIME_SPAN_MILLISECOND;
+
+  px_duktape_natives_track_expiry (&heap->expiry);
+}
+
+/* Returns FALSE if the budget was exceeded */
+static gboolean
+px_duktape_heap_stop_budget (PxDuktapeHeap *heap)
+{
+  heap->deadline = 0;
+  px_duktape_natives_track_expiry (NULL);
+
+  return !heap->timed_out;
+}
+
+/* Define the helpers in the global object of @ctx, and read the version of
+ * duktape while allocations are protected */
+static duk_ret_t
+px_duktape_heap_setup (duk_context *ctx,
+                       void        *udata)
+{
+  PxDuktapeHeap *heap = udata;
 
-  duk_push_c_function (self->ctx, dns_resolve, 1);
-  duk_put_global_string (self->ctx, "dnsResolve");
+  duk_get_global_string (ctx, "Duktape");
+  duk_get_prop_string (ctx, -1, "version");
+  heap->version = (long)duk_get_number (ctx, -1);
+  duk_pop_2 (ctx);
 
-  duk_push_c_function (self->ctx, my_ip_address, 1);
-  duk_put_global_string (self->ctx, "myIpAddress");
+  duk_push_c_function (ctx, dns_resolve, 1);
+  duk_put_global_string (ctx, "dnsResolve");
 
-  duk_push_c_function (self->ctx, alert, 1);
-  duk_put_global_string (self->ctx, "alert");
+  duk_push_c_function (ctx, my_ip_address, 0);
+  duk_put_global_string (ctx, "myIpAddress");
 
-  duk_push_string (self->ctx, JAVASCRIPT_ROUTINES);
-  if (duk_peval_noresult (self->ctx))
+  duk_push_c_function (ctx, my_ip_address_ex, 0);
+  duk_put_global_string (ctx, "myIpAddressEx");
+
+  duk_push_c_function (ctx, alert, 1);
+  duk_put_global_string (ctx, "alert");
+
+  if (!px_duktape_routines_load (ctx))
+    return DUK_RET_ERROR;
+
+  return 0;
+}
+
+static PxDuktapeHeap *
+px_duktape_heap_new (guint   timeout,
+                     guint64 memory_limit)
+{
+  PxDuktapeHeap *heap = g_new0 (PxDuktapeHeap, 1);
+
+  heap->timeout = timeout;
+  heap->arena = px_duktape_arena_new (MIN (memory_limit, G_MAXSIZE));
+  heap->ctx = duk_create_heap (px_duktape_alloc, px_duktape_realloc, px_duktape_free, heap, NULL);
+  if (!heap->ctx)
+    goto error;
+
+  if (duk_safe_call (heap->ctx, px_duktape_heap_setup, heap, 0, 1) != 0)
     goto error;
+  duk_pop (heap->ctx);
 
-  return;
+  return heap;
 
 error:
-  duk_destroy_heap (self->ctx);
+  px_duktape_heap_free (heap);
+  return NULL;
+}
+
+/*
+ * Compiled PAC files are cached as duktape bytecode, keyed by a hash of the
+ * PAC and the duktape version, in memory for all runners of the process and
+ * on disk if the runner has a cache directory. Duktape does not validate
+ * bytecode, so files on disk start with a checksum of their contents.
+ */
+#define PX_BYTECODE_CACHE_SIZE 16
+#define PX_BYTECODE_CHECKSUM_LEN 64
+
+static PxLruCache *
+px_bytecode_cache_get (void)
+{
+  static gsize bytecode_cache = 0;
+
+  if (g_once_init_enter (&bytecode_cache))
+    g_once_init_leave (&bytecode_cache, (gsize)px_lru_cache_new (PX_BYTECODE_CACHE_SIZE, (GBoxedCopyFunc)g_bytes_ref, (GDestroyNotify)g_bytes_unref));
+
+  return (PxLruCache *)bytecode_cache;
+}
+
+/* Bytecode is keyed by the duktape version in use, which need not be the
+ * one libproxy was built against */
+static char *
+px_bytecode_cache_key (PxDuktapeHeap *heap,
+                       GBytes        *pac_data)
+{
+  g_autofree char *hash = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, pac_data);
+
+  return g_strdup_printf ("%s-%ld", hash, heap->version);
+}
+
+static char *
+px_bytecode_cache_path (PxPacRunnerDuktape *self,
+                        const char         *key)
+{
+  g_autofree char *name = g_strconcat (key, ".dukbc", NULL);
+
+  return g_build_filename (self->cache_dir, name, NULL);
+}
+
+static GBytes *
+px_bytecode_cache_lookup (PxPacRunnerDuktape *self,
+                          const char         *key)
+{
+  g_autofree char *path = NULL;
+  g_autofree char *contents = NULL;
+  g_autofree char *checksum = NULL;
+  GBytes *bytecode;
+  gsize len;
+
+  bytecode = px_lru_cache_lookup (px_bytecode_cache_get (), key);
+  if (bytecode || !self->cache_dir)
+    return bytecode;
+
+  path = px_bytecode_cache_path (self, key);
+  if (!g_file_get_contents (path, &contents, &len, NULL) || len <= PX_BYTECODE_CHECKSUM_LEN)
+    return NULL;
+
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
+                                          (const guchar *)contents + PX_BYTECODE_CHECKSUM_LEN,
+                                          len - PX_BYTECODE_CHECKSUM_LEN);
+  if (strncmp (checksum, contents, PX_BYTECODE_CHECKSUM_LEN) != 0) {
+    g_debug ("%s: Ignoring corrupted bytecode in %s", __FUNCTION__, path);
+    return NULL;
+  }
+
+  bytecode = g_bytes_new (contents + PX_BYTECODE_CHECKSUM_LEN, len - PX_BYTECODE_CHECKSUM_LEN);
+  px_lru_cache_insert (px_bytecode_cache_get (), key, g_bytes_ref (bytecode), 0);
+
+  return bytecode;
+}
+
+static void
+px_bytecode_cache_store (PxPacRunnerDuktape *self,
+                         const char         *key,
+                         GBytes             *bytecode)
+{
+  g_autoptr (GError) error = NULL;
+  g_autoptr (GByteArray) contents = NULL;
+  g_autofree char *checksum = NULL;
+  g_autofree char *path = NULL;
+
+  px_lru_cache_insert (px_bytecode_cache_get (), key, g_bytes_ref (bytecode), 0);
+
+  if (!self->cache_dir)
+    return;
+
+  if (g_mkdir_with_parents (self->cache_dir, 0700) != 0) {
+    g_debug ("%s: Could not create %s", __FUNCTION__, self->cache_dir);
+    return;
+  }
+
+  checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA256, bytecode);
+  contents = g_byte_array_new ();
+  g_byte_array_append (contents, (const guint8 *)checksum, PX_BYTECODE_CHECKSUM_LEN);
+  g_byte_array_append (contents, g_bytes_get_data (bytecode, NULL), g_bytes_get_size (bytecode));
+
+  path = px_bytecode_cache_path (self, key);
+  if (!g_file_set_contents (path, (const char *)contents->data, contents->len, &error))
+    g_debug ("%s: Could not store bytecode: %s", __FUNCTION__, error->message);
+}
+
+/*
+ * Push a thread with fresh built-ins onto @ctx and copy the helpers, which
+ * are the enumerable properties of the global object of @ctx, into its
+ * global object.
+ */
+static duk_ret_t
+px_duktape_push_pac_thread (duk_context *ctx,
+                            void        *udata)
+{
+  duk_context *pac_ctx;
+
+  duk_push_thread_new_globalenv (ctx);
+  pac_ctx = duk_get_context (ctx, -1);
+
+  duk_push_global_object (pac_ctx);
+  duk_push_global_object (ctx);
+  duk_enum (ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+  while (duk_next (ctx, -1, 1)) {
+    duk_xmove_top (pac_ctx, ctx, 2);
+    duk_put_prop (pac_ctx, -3);
+  }
+  duk_pop_2 (ctx);
+  duk_pop (pac_ctx);
+
+  return 1;
+}
+
+/* Replace the thread of the previous PAC with a fresh one */
+static gboolean
+px_duktape_heap_reset (PxDuktapeHeap *heap)
+{
+  heap->pac_ctx = NULL;
+  heap->pac_serial = 0;
+
+  /* Globals and closures of a PAC reference each other */
+  duk_set_top (heap->ctx, 0);
+  duk_gc (heap->ctx, 0);
+
+  if (duk_safe_call (heap->ctx, px_duktape_push_pac_thread, NULL, 0, 1) != 0) {
+    duk_pop (heap->ctx);
+    return FALSE;
+  }
+
+  heap->pac_ctx = duk_get_context (heap->ctx, 0);
+
+  return TRUE;
+}
+
+static duk_ret_t
+px_duktape_dump_function (duk_context *ctx,
+                          void        *udata)
+{
+  duk_dup (ctx, 0);
+  duk_dump_function (ctx);
+
+  return 2;
+}
+
+/*
+ * Compile @pac_data into a function on top of the stack of a fresh PAC
+ * thread of @heap.
+ *
+ * Returns: (transfer full) (nullable): the bytecode of the function or %NULL
+ *   if the PAC does not compile
+ */
+static GBytes *
+px_duktape_heap_compile_pac (PxDuktapeHeap *heap,
+                             GBytes        *pac_data)
+{
+  gsize len;
+  gconstpointer content = g_bytes_get_data (pac_data, &len);
+  duk_size_t size;
+  void *buffer;
+  GBytes *bytecode;
+
+  if (!px_duktape_heap_reset (heap))
+    return NULL;
+
+  if (duk_pcompile_lstring (heap->pac_ctx, 0, content, len)) {
+    duk_pop (heap->pac_ctx);
+    return NULL;
+  }
+
+  /* Leaves the function and its bytecode on the stack */
+  if (duk_safe_call (heap->pac_ctx, px_duktape_dump_function, NULL, 1, 2) != 0) {
+    duk_pop_2 (heap->pac_ctx);
+    return NULL;
+  }
+
+  buffer = duk_get_buffer_data (heap->pac_ctx, -1, &size);
+  bytecode = g_bytes_new (buffer, size);
+  duk_pop (heap->pac_ctx);
+
+  return bytecode;
+}
+
+/*
+ * Run the PAC function on top of the stack of @heap, defining
+ * FindProxyForURL().
+ */
+static gboolean
+px_duktape_heap_run_pac (PxDuktapeHeap *heap,
+                         guint          pac_serial)
+{
+  gboolean ret;
+
+  px_duktape_heap_start_budget (heap);
+  ret = duk_pcall (heap->pac_ctx, 0) == 0;
+  ret = px_duktape_heap_stop_budget (heap) && ret;
+
+  duk_pop (heap->pac_ctx);
+  heap->pac_serial = ret ? pac_serial : 0;
+
+  return ret;
+}
+
+static duk_ret_t
+px_duktape_load_function (duk_context *ctx,
+                          void        *udata)
+{
+  GBytes *bytecode = udata;
+  gsize len;
+  gconstpointer data = g_bytes_get_data (bytecode, &len);
+
+  memcpy (duk_push_fixed_buffer (ctx, len), data, len);
+  duk_load_function (ctx);
+
+  return 1;
+}
+
+/* Load @bytecode into a fresh PAC thread of @heap and run it */
+static gboolean
+px_duktape_heap_load_pac (PxDuktapeHeap *heap,
+                          GBytes        *bytecode,
+                          guint          pac_serial)
+{
+  if (!px_duktape_heap_reset (heap))
+    return FALSE;
+
+  if (duk_safe_call (heap->pac_ctx, px_duktape_load_function, bytecode, 0, 1) != 0) {
+    duk_pop (heap->pac_ctx);
+    return FALSE;
+  }
+
+  return px_duktape_heap_run_pac (heap, pac_serial);
+}
+
+/*
+ * The results of a PAC whose FindProxyForURL() only depends on the host are
+ * memoized per host, so repeated hosts skip the interpreter. Keys include
+ * the serial of the PAC which computed them. PACs may also use the time
+ * predicates, whose results are kept until the first of the predicates
+ * called could change its mind.
+ */
+#define PX_DUKTAPE_MEMO_SIZE 512
+
+static char *
+px_pacrunner_duktape_memo_key (guint  pac_serial,
+                               GUri  *uri)
+{
+  if (!g_uri_get_host (uri))
+    return NULL;
+
+  return g_strdup_printf ("%u:%s", pac_serial, g_uri_get_host (uri));
+}
+
+static char *
+px_pacrunner_duktape_memo_lookup (PxPacRunnerDuktape *self,
+                                  GUri               *uri)
+{
+  g_autofree char *key = NULL;
+
+  g_mutex_lock (&self->mutex);
+  if (self->pac_memoizable)
+    key = px_pacrunner_duktape_memo_key (self->pac_serial, uri);
+  g_mutex_unlock (&self->mutex);
+
+  return key ? px_lru_cache_lookup (self->memo, key) : NULL;
+}
+
+/* Remember @proxy, just computed by @heap, as the response for the host of @uri */
+static void
+px_pacrunner_duktape_memo_insert (PxPacRunnerDuktape *self,
+                                  PxDuktapeHeap      *heap,
+                                  GUri               *uri,
+                                  const char         *proxy)
+{
+  g_autofree char *key = NULL;
+  gint64 expires = 0;
+
+  if (heap->expiry != G_MAXINT64) {
+    /* The cache expires entries on the monotonic clock */
+    expires = g_get_monotonic_time () + (heap->expiry - g_get_real_time ());
+    if (expires <= g_get_monotonic_time ())
+      return;
+  }
+
+  g_mutex_lock (&self->mutex);
+  if (self->pac_memoizable && heap->pac_serial == self->pac_serial && !heap->exhausted)
+    key = px_pacrunner_duktape_memo_key (heap->pac_serial, uri);
+  g_mutex_unlock (&self->mutex);
+
+  if (key)
+    px_lru_cache_insert (self->memo, key, g_strdup (proxy), expires);
+}
+
+/*
+ * Look @uri up in the decision table of the current PAC, if it could be
+ * compiled into one.
+ */
+static char *
+px_pacrunner_duktape_table_lookup (PxPacRunnerDuktape *self,
+                                   GUri               *uri)
+{
+  g_autoptr (PxPacTable) table = NULL;
+  const char *proxy;
+
+  if (!g_uri_get_host (uri))
+    return NULL;
+
+  g_mutex_lock (&self->mutex);
+  if (self->pac_table)
+    table = px_pac_table_ref (self->pac_table);
+  g_mutex_unlock (&self->mutex);
+
+  if (!table)
+    return NULL;
+
+  proxy = px_pac_table_lookup (table, g_uri_get_host (uri));
+
+  return proxy ? g_strdup (proxy) : NULL;
+}
+
+/*
+ * Take a heap out of the pool, creating a new one if the pool is not full
+ * yet or waiting for another thread to return one otherwise. Waiting is
+ * limited to the time budget, as heaps stuck in loops which do not
+ * allocate are never returned; @timed_out is set if it ran out.
+ */
+static PxDuktapeHeap *
+px_pacrunner_duktape_checkout (PxPacRunnerDuktape *self,
+                               gboolean           *timed_out)
+{
+  PxDuktapeHeap *heap = NULL;
+  gint64 deadline = 0;
+
+  if (timed_out)
+    *timed_out = FALSE;
+
+  g_mutex_lock (&self->mutex);
+  if (self->timeout > 0)
+    deadline = g_get_monotonic_time () + self->timeout * G_TIME_SPAN_MILLISECOND;
+
+  while (self->idle_heaps->len == 0 && self->n_heaps >= self->pool_size) {
+    if (deadline == 0) {
+      g_cond_wait (&self->cond, &self->mutex);
+    } else if (!g_cond_wait_until (&self->cond, &self->mutex, deadline)) {
+      g_mutex_unlock (&self->mutex);
+      g_debug ("%s: No heap became available in time", __FUNCTION__);
+      if (timed_out)
+        *timed_out = TRUE;
+      return NULL;
+    }
+  }
+
+  if (self->idle_heaps->len > 0) {
+    heap = g_ptr_array_steal_index_fast (self->idle_heaps, self->idle_heaps->len - 1);
+    g_mutex_unlock (&self->mutex);
+    return heap;
+  }
+
+  self->n_heaps++;
+  g_mutex_unlock (&self->mutex);
+
+  heap = px_duktape_heap_new (self->timeout, self->memory_limit);
+  if (!heap) {
+    g_mutex_lock (&self->mutex);
+    self->n_heaps--;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+  }
+
+  return heap;
+}
+
+/*
+ * Update the memory statistics with the current use of @heap, which is
+ * @used bytes. Must be called with the mutex held.
+ */
+static void
+px_pacrunner_duktape_account (PxPacRunnerDuktape *self,
+                              PxDuktapeHeap      *heap,
+                              gsize               used)
+{
+  guint64 others = self->memory_used - heap->reported_used;
+
+  self->memory_peak = MAX (self->memory_peak, others + px_duktape_arena_get_peak (heap->arena));
+  self->memory_used = others + used;
+  heap->reported_used = used;
+}
+
+static void
+px_pacrunner_duktape_checkin (PxPacRunnerDuktape *self,
+                              PxDuktapeHeap      *heap)
+{
+  g_mutex_lock (&self->mutex);
+  px_pacrunner_duktape_account (self, heap, px_duktape_arena_get_used (heap->arena));
+  g_ptr_array_add (self->idle_heaps, heap);
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Destroy a heap instead of returning it, making room for a new one */
+static void
+px_pacrunner_duktape_discard (PxPacRunnerDuktape *self,
+                              PxDuktapeHeap      *heap)
+{
+  g_mutex_lock (&self->mutex);
+  px_pacrunner_duktape_account (self, heap, 0);
+  g_mutex_unlock (&self->mutex);
+
+  px_duktape_heap_free (heap);
+
+  g_mutex_lock (&self->mutex);
+  self->n_heaps--;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Return @heap to the pool, unless it ran out of time or memory */
+static void
+px_pacrunner_duktape_release (PxPacRunnerDuktape *self,
+                              PxDuktapeHeap      *heap)
+{
+  if (heap->timed_out || heap->exhausted)
+    px_pacrunner_duktape_discard (self, heap);
+  else
+    px_pacrunner_duktape_checkin (self, heap);
+}
+
+static void
+px_pacrunner_duktape_init (PxPacRunnerDuktape *self)
+{
+  self->pool_size = 1;
+
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->idle_heaps = g_ptr_array_new_with_free_func ((GDestroyNotify)px_duktape_heap_free);
+  self->memo = px_lru_cache_new (PX_DUKTAPE_MEMO_SIZE, (GBoxedCopyFunc)g_strdup, g_free);
 }
 
 static void
@@ -153,17 +1026,105 @@ px_pacrunner_duktape_dispose (GObject *object)
 {
   PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (object);
 
-  g_clear_pointer (&self->ctx, duk_destroy_heap);
+  g_ptr_array_set_size (self->idle_heaps, 0);
+  g_clear_pointer (&self->pac_bytecode, g_bytes_unref);
 
   G_OBJECT_CLASS (px_pacrunner_duktape_parent_class)->dispose (object);
 }
 
+static void
+px_pacrunner_duktape_finalize (GObject *object)
+{
+  PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (object);
+
+  g_clear_pointer (&self->idle_heaps, g_ptr_array_unref);
+  g_clear_pointer (&self->memo, px_lru_cache_free);
+  g_clear_pointer (&self->pac_table, px_pac_table_unref);
+  g_clear_pointer (&self->cache_dir, g_free);
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (px_pacrunner_duktape_parent_class)->finalize (object);
+}
+
+static void
+px_pacrunner_duktape_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+  PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (object);
+
+  switch (prop_id) {
+    case PROP_POOL_SIZE:
+      self->pool_size = MAX (g_value_get_uint (value), 1);
+      break;
+    case PROP_CACHE_DIR:
+      self->cache_dir = g_value_dup_string (value);
+      break;
+    case PROP_TIMEOUT:
+      self->timeout = g_value_get_uint (value);
+      break;
+    case PROP_MEMORY_LIMIT:
+      self->memory_limit = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
+static void
+px_pacrunner_duktape_get_property (GObject    *object,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+  PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (object);
+
+  switch (prop_id) {
+    case PROP_POOL_SIZE:
+      g_value_set_uint (value, self->pool_size);
+      break;
+    case PROP_CACHE_DIR:
+      g_value_set_string (value, self->cache_dir);
+      break;
+    case PROP_TIMEOUT:
+      g_value_set_uint (value, self->timeout);
+      break;
+    case PROP_MEMORY_LIMIT:
+      g_value_set_uint64 (value, self->memory_limit);
+      break;
+    case PROP_MEMORY_USED:
+      g_mutex_lock (&self->mutex);
+      g_value_set_uint64 (value, self->memory_used);
+      g_mutex_unlock (&self->mutex);
+      break;
+    case PROP_MEMORY_PEAK:
+      g_mutex_lock (&self->mutex);
+      g_value_set_uint64 (value, self->memory_peak);
+      g_mutex_unlock (&self->mutex);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+  }
+}
+
 static void
 px_pacrunner_duktape_class_init (PxPacRunnerDuktapeClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
   object_class->dispose = px_pacrunner_duktape_dispose;
+  object_class->finalize = px_pacrunner_duktape_finalize;
+  object_class->set_property = px_pacrunner_duktape_set_property;
+  object_class->get_property = px_pacrunner_duktape_get_property;
+
+  g_object_class_override_property (object_class, PROP_POOL_SIZE, "pool-size");
+  g_object_class_override_property (object_class, PROP_CACHE_DIR, "cache-dir");
+  g_object_class_override_property (object_class, PROP_TIMEOUT, "timeout");
+  g_object_class_override_property (object_class, PROP_MEMORY_LIMIT, "memory-limit");
+  g_object_class_override_property (object_class, PROP_MEMORY_USED, "memory-used");
+  g_object_class_override_property (object_class, PROP_MEMORY_PEAK, "memory-peak");
 }
 
 static gboolean
@@ -171,48 +1132,265 @@ px_pacrunner_duktape_set_pac (PxPacRunner *pacrunner,
                               GBytes      *pac_data)
 {
   PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (pacrunner);
-  gsize len;
-  gconstpointer content = g_bytes_get_data (pac_data, &len);
-
-  duk_push_lstring (self->ctx, content, len);
+  g_autofree char *key = NULL;
+  g_autoptr (GBytes) bytecode = NULL;
+  g_autoptr (PxPacTable) table = NULL;
+  PxPacDependencies dependencies;
+  PxDuktapeHeap *heap;
 
-  if (duk_peval_noresult (self->ctx)) {
+  heap = px_pacrunner_duktape_checkout (self, NULL);
+  if (!heap)
     return FALSE;
+
+  key = px_bytecode_cache_key (heap, pac_data);
+
+  /* Only publish the PAC once it is known to compile and run */
+  bytecode = px_bytecode_cache_lookup (self, key);
+  if (bytecode) {
+    g_debug ("%s: Using cached bytecode %s", __FUNCTION__, key);
+    if (!px_duktape_heap_load_pac (heap, bytecode, 0)) {
+      px_pacrunner_duktape_release (self, heap);
+      return FALSE;
+    }
+  } else {
+    bytecode = px_duktape_heap_compile_pac (heap, pac_data);
+    if (!bytecode || !px_duktape_heap_run_pac (heap, 0)) {
+      px_pacrunner_duktape_release (self, heap);
+      return FALSE;
+    }
+
+    px_bytecode_cache_store (self, key, bytecode);
   }
 
+  dependencies = px_pac_analyze (g_bytes_get_data (pac_data, NULL), g_bytes_get_size (pac_data));
+  table = px_pac_table_compile (g_bytes_get_data (pac_data, NULL), g_bytes_get_size (pac_data));
+  if (table)
+    g_debug ("%s: PAC compiled to a decision table of %u rules", __FUNCTION__, px_pac_table_get_n_rules (table));
+  g_debug ("%s: PAC dependencies: 0x%x", __FUNCTION__, dependencies);
+
+  g_mutex_lock (&self->mutex);
+  g_clear_pointer (&self->pac_bytecode, g_bytes_unref);
+  self->pac_bytecode = g_bytes_ref (bytecode);
+  g_clear_pointer (&self->pac_table, px_pac_table_unref);
+  self->pac_table = g_steal_pointer (&table);
+  heap->pac_serial = ++self->pac_serial;
+  self->pac_memoizable = (dependencies & ~PX_PAC_DEPENDS_TIME) == 0;
+  g_mutex_unlock (&self->mutex);
+
+  px_lru_cache_flush (self->memo);
+
+  px_pacrunner_duktape_release (self, heap);
+
   return TRUE;
 }
 
+/* Call FindProxyForURL() with the url and host in @udata */
+static duk_ret_t
+px_duktape_find_proxy (duk_context *ctx,
+                       void        *udata)
+{
+  const char **args = udata;
+
+  duk_get_global_string (ctx, "FindProxyForURL");
+  duk_push_string (ctx, args[0]);
+  duk_push_string (ctx, args[1]);
+  duk_call (ctx, 2);
+
+  return 1;
+}
+
+/*
+ * Check out a heap running the current PAC. Returns %NULL if no heap is
+ * available, setting @timed_out if none became available in time or
+ * loading the PAC took too long.
+ */
+static PxDuktapeHeap *
+px_pacrunner_duktape_checkout_pac (PxPacRunnerDuktape *self,
+                                   gboolean           *timed_out)
+{
+  g_autoptr (GBytes) pac_bytecode = NULL;
+  PxDuktapeHeap *heap;
+  guint pac_serial;
+
+  heap = px_pacrunner_duktape_checkout (self, timed_out);
+  if (!heap)
+    return NULL;
+
+  g_mutex_lock (&self->mutex);
+  pac_serial = self->pac_serial;
+  if (self->pac_bytecode)
+    pac_bytecode = g_bytes_ref (self->pac_bytecode);
+  g_mutex_unlock (&self->mutex);
+
+  /* Catch up with the last PAC set while this heap was idle */
+  if (heap->pac_serial != pac_serial && pac_bytecode) {
+    if (!px_duktape_heap_load_pac (heap, pac_bytecode, pac_serial) && heap->timed_out) {
+      px_pacrunner_duktape_discard (self, heap);
+      *timed_out = TRUE;
+      return NULL;
+    }
+  }
+
+  return heap;
+}
+
 static char *
 px_pacrunner_duktape_run (PxPacRunner *pacrunner,
                           GUri        *uri)
 {
   PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (pacrunner);
+  g_autofree char *uri_string = NULL;
+  const char *args[2];
+  PxDuktapeHeap *heap;
+  gboolean timed_out;
+  char *proxy_string;
   duk_int_t result;
 
-  duk_get_global_string (self->ctx, "FindProxyForURL");
-  duk_push_string (self->ctx, g_uri_to_string (uri));
-  duk_push_string (self->ctx, g_uri_get_host (uri));
-  result = duk_pcall (self->ctx, 2);
+  proxy_string = px_pacrunner_duktape_table_lookup (self, uri);
+  if (!proxy_string)
+    proxy_string = px_pacrunner_duktape_memo_lookup (self, uri);
+  if (proxy_string)
+    return proxy_string;
+
+  heap = px_pacrunner_duktape_checkout_pac (self, &timed_out);
+  if (!heap)
+    return timed_out ? NULL : g_strdup ("");
+
+  if (!heap->pac_ctx) {
+    px_pacrunner_duktape_release (self, heap);
+    return g_strdup ("");
+  }
+
+  uri_string = g_uri_to_string (uri);
+  args[0] = uri_string;
+  args[1] = g_uri_get_host (uri);
+
+  px_duktape_heap_start_budget (heap);
+  result = duk_safe_call (heap->pac_ctx, px_duktape_find_proxy, args, 0, 1);
+  if (!px_duktape_heap_stop_budget (heap)) {
+    px_pacrunner_duktape_discard (self, heap);
+    return NULL;
+  }
 
   if (result == 0) {
-    const char *proxy = duk_get_string (self->ctx, 0);
-    char *proxy_string;
+    const char *proxy = duk_get_string (heap->pac_ctx, -1);
 
-    if (!proxy) {
-      duk_pop (self->ctx);
-      return g_strdup ("");
+    proxy_string = g_strdup (proxy ? proxy : "");
+    px_pacrunner_duktape_memo_insert (self, heap, uri, proxy_string);
+  } else {
+    proxy_string = g_strdup ("");
+  }
+
+  duk_pop (heap->pac_ctx);
+  px_pacrunner_duktape_release (self, heap);
+
+  return proxy_string;
+}
+
+typedef struct {
+  PxPacRunnerDuktape *self;
+  PxDuktapeHeap *heap;
+  GPtrArray *uris;
+  GPtrArray *responses;
+  char *uri_string;
+} PxDuktapeBatch;
+
+/*
+ * Call FindProxyForURL() for each url of @udata which has no response yet,
+ * looking the function up only once. Stops at the first evaluation which
+ * exceeds the time budget or runs out of memory, leaving the url without a
+ * response.
+ */
+static duk_ret_t
+px_duktape_find_proxy_batch (duk_context *ctx,
+                             void        *udata)
+{
+  PxDuktapeBatch *batch = udata;
+
+  duk_get_global_string (ctx, "FindProxyForURL");
+
+  while (batch->responses->len < batch->uris->len && !batch->heap->exhausted) {
+    GUri *uri = g_ptr_array_index (batch->uris, batch->responses->len);
+    const char *proxy = NULL;
+    char *known;
+    duk_int_t result;
+
+    known = px_pacrunner_duktape_table_lookup (batch->self, uri);
+    if (!known)
+      known = px_pacrunner_duktape_memo_lookup (batch->self, uri);
+    if (known) {
+      g_ptr_array_add (batch->responses, known);
+      continue;
     }
 
-    proxy_string = g_strdup (proxy);
+    /* Owned by @batch, as pushing may throw */
+    g_free (batch->uri_string);
+    batch->uri_string = g_uri_to_string (uri);
 
-    duk_pop (self->ctx);
+    duk_dup (ctx, 0);
+    duk_push_string (ctx, batch->uri_string);
+    duk_push_string (ctx, g_uri_get_host (uri));
 
-    return proxy_string;
+    px_duktape_heap_start_budget (batch->heap);
+    result = duk_pcall (ctx, 2);
+    if (!px_duktape_heap_stop_budget (batch->heap))
+      return 0;
+
+    /* Not the answer of the PAC, the url is retried on a fresh heap */
+    if (result != 0 && batch->heap->exhausted)
+      return 0;
+
+    if (result == 0) {
+      proxy = duk_get_string (ctx, -1);
+      px_pacrunner_duktape_memo_insert (batch->self, batch->heap, uri, proxy ? proxy : "");
+    }
+
+    g_ptr_array_add (batch->responses, g_strdup (proxy ? proxy : ""));
+    duk_pop (ctx);
   }
 
-  duk_pop (self->ctx);
-  return g_strdup ("");
+  return 0;
+}
+
+static GPtrArray *
+px_pacrunner_duktape_run_batch (PxPacRunner *pacrunner,
+                                GPtrArray   *uris)
+{
+  PxPacRunnerDuktape *self = PX_PACRUNNER_DUKTAPE (pacrunner);
+  PxDuktapeBatch batch = { self, NULL, uris, NULL, NULL };
+  gboolean timed_out;
+
+  batch.responses = g_ptr_array_new_full (uris->len, g_free);
+
+  batch.heap = px_pacrunner_duktape_checkout_pac (self, &timed_out);
+  if (batch.heap && batch.heap->pac_ctx) {
+    duk_safe_call (batch.heap->pac_ctx, px_duktape_find_proxy_batch, &batch, 0, 1);
+    duk_pop (batch.heap->pac_ctx);
+
+    if (batch.heap->timed_out)
+      g_ptr_array_add (batch.responses, NULL);
+  }
+
+  if (batch.heap)
+    px_pacrunner_duktape_release (self, batch.heap);
+  else if (timed_out)
+    g_ptr_array_add (batch.responses, NULL);
+
+  g_free (batch.uri_string);
+
+  /* Evaluate whatever the batch did not get to one by one. A heap which ran
+   * out of memory was destroyed on release, so each gets a fresh one. */
+  while (batch.responses->len < uris->len)
+    g_ptr_array_add (batch.responses, px_pacrunner_duktape_run (pacrunner, g_ptr_array_index (uris, batch.responses->len)));
+
+  return batch.responses;
+}
+
+static void
+px_pacrunner_duktape_network_changed (PxPacRunner *pacrunner)
+{
+  px_lru_cache_flush (px_dns_cache_get ());
+  px_my_ip_reset ();
 }
 
 static void
@@ -220,4 +1398,6 @@ px_pacrunner_iface_init (PxPacRunnerInterface *iface)
 {
   iface->set_pac = px_pacrunner_duktape_set_pac;
   iface->run = px_pacrunner_duktape_run;
+  iface->run_batch = px_pacrunner_duktape_run_batch;
+  iface->network_changed = px_pacrunner_duktape_network_changed;
 }
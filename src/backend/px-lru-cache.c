@@ -0,0 +1,259 @@
+/* px-lru-cache.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "px-lru-cache.h"
+
+/**
+ * PxLruCache:
+ *
+ * A small, thread safe, string keyed cache with least-recently-used
+ * eviction and optional per entry expiry.
+ *
+ * Values are owned by the cache. Lookups hand out a copy made with the
+ * copy function given at construction time, so callers never hold on to
+ * memory that might be evicted by another thread.
+ */
+
+typedef struct {
+  char *key;
+  gpointer value;
+  gint64 expires;
+  GList link;
+} PxLruCacheEntry;
+
+struct _PxLruCache {
+  GMutex mutex;
+  GHashTable *entries;
+  GQueue lru;
+
+  guint max_entries;
+  GBoxedCopyFunc value_copy;
+  GDestroyNotify value_free;
+};
+
+static void
+px_lru_cache_entry_free (PxLruCache      *self,
+                         PxLruCacheEntry *entry)
+{
+  g_free (entry->key);
+  if (self->value_free)
+    self->value_free (entry->value);
+  g_free (entry);
+}
+
+/* Must be called with the mutex held */
+static void
+px_lru_cache_drop (PxLruCache      *self,
+                   PxLruCacheEntry *entry)
+{
+  g_queue_unlink (&self->lru, &entry->link);
+  g_hash_table_remove (self->entries, entry->key);
+  px_lru_cache_entry_free (self, entry);
+}
+
+/**
+ * px_lru_cache_new:
+ * @max_entries: maximum number of entries, 0 disables the cache
+ * @value_copy: function used to copy values handed out by lookups
+ * @value_free: (nullable): function used to free stored values
+ *
+ * Create a new `PxLruCache`.
+ *
+ * Returns: (transfer full): the newly created cache
+ */
+PxLruCache *
+px_lru_cache_new (guint           max_entries,
+                  GBoxedCopyFunc  value_copy,
+                  GDestroyNotify  value_free)
+{
+  PxLruCache *self = g_new0 (PxLruCache, 1);
+
+  g_mutex_init (&self->mutex);
+  self->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  g_queue_init (&self->lru);
+  self->max_entries = max_entries;
+  self->value_copy = value_copy;
+  self->value_free = value_free;
+
+  return self;
+}
+
+/**
+ * px_lru_cache_free:
+ * @self: a `PxLruCache`
+ *
+ * Frees the cache and all stored values.
+ */
+void
+px_lru_cache_free (PxLruCache *self)
+{
+  px_lru_cache_flush (self);
+  g_hash_table_unref (self->entries);
+  g_mutex_clear (&self->mutex);
+  g_free (self);
+}
+
+/**
+ * px_lru_cache_lookup:
+ * @self: a `PxLruCache`
+ * @key: key to look up
+ *
+ * Look up @key and mark it as most recently used. Expired entries are
+ * dropped and reported as missing.
+ *
+ * Returns: (transfer full) (nullable): a copy of the stored value or %NULL
+ */
+gpointer
+px_lru_cache_lookup (PxLruCache *self,
+                     const char *key)
+{
+  PxLruCacheEntry *entry;
+  gpointer value = NULL;
+
+  g_mutex_lock (&self->mutex);
+
+  entry = g_hash_table_lookup (self->entries, key);
+  if (entry) {
+    if (entry->expires != 0 && entry->expires <= g_get_monotonic_time ()) {
+      px_lru_cache_drop (self, entry);
+    } else {
+      g_queue_unlink (&self->lru, &entry->link);
+      g_queue_push_head_link (&self->lru, &entry->link);
+      value = self->value_copy (entry->value);
+    }
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return value;
+}
+
+/**
+ * px_lru_cache_insert:
+ * @self: a `PxLruCache`
+ * @key: key to store @value under
+ * @value: (transfer full): value to store
+ * @expires: monotonic time in microseconds after which the entry is stale,
+ *   or 0 for no expiry
+ *
+ * Store @value under @key, replacing any previous value. Evicts the least
+ * recently used entry when the cache is full.
+ */
+void
+px_lru_cache_insert (PxLruCache *self,
+                     const char *key,
+                     gpointer    value,
+                     gint64      expires)
+{
+  PxLruCacheEntry *entry;
+
+  g_mutex_lock (&self->mutex);
+
+  if (self->max_entries == 0) {
+    g_mutex_unlock (&self->mutex);
+    if (self->value_free)
+      self->value_free (value);
+    return;
+  }
+
+  entry = g_hash_table_lookup (self->entries, key);
+  if (entry)
+    px_lru_cache_drop (self, entry);
+
+  while (g_hash_table_size (self->entries) >= self->max_entries) {
+    GList *oldest = g_queue_peek_tail_link (&self->lru);
+
+    px_lru_cache_drop (self, oldest->data);
+  }
+
+  entry = g_new0 (PxLruCacheEntry, 1);
+  entry->key = g_strdup (key);
+  entry->value = value;
+  entry->expires = expires;
+  entry->link.data = entry;
+
+  g_hash_table_insert (self->entries, entry->key, entry);
+  g_queue_push_head_link (&self->lru, &entry->link);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * px_lru_cache_remove:
+ * @self: a `PxLruCache`
+ * @key: key to remove
+ *
+ * Remove @key from the cache, if present.
+ */
+void
+px_lru_cache_remove (PxLruCache *self,
+                     const char *key)
+{
+  PxLruCacheEntry *entry;
+
+  g_mutex_lock (&self->mutex);
+
+  entry = g_hash_table_lookup (self->entries, key);
+  if (entry)
+    px_lru_cache_drop (self, entry);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * px_lru_cache_flush:
+ * @self: a `PxLruCache`
+ *
+ * Remove all entries from the cache.
+ */
+void
+px_lru_cache_flush (PxLruCache *self)
+{
+  GList *link;
+
+  g_mutex_lock (&self->mutex);
+
+  while ((link = g_queue_peek_tail_link (&self->lru)) != NULL)
+    px_lru_cache_drop (self, link->data);
+
+  g_mutex_unlock (&self->mutex);
+}
+
+/**
+ * px_lru_cache_get_size:
+ * @self: a `PxLruCache`
+ *
+ * Get the number of entries currently stored, including expired entries
+ * that have not been looked up since they expired.
+ *
+ * Returns: number of entries
+ */
+guint
+px_lru_cache_get_size (PxLruCache *self)
+{
+  guint size;
+
+  g_mutex_lock (&self->mutex);
+  size = g_hash_table_size (self->entries);
+  g_mutex_unlock (&self->mutex);
+
+  return size;
+}
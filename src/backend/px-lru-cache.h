@@ -0,0 +1,51 @@
+/* px-lru-cache.h
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _PxLruCache PxLruCache;
+
+PxLruCache *px_lru_cache_new (guint           max_entries,
+                              GBoxedCopyFunc  value_copy,
+                              GDestroyNotify  value_free);
+
+void px_lru_cache_free (PxLruCache *self);
+
+gpointer px_lru_cache_lookup (PxLruCache *self,
+                              const char *key);
+
+void px_lru_cache_insert (PxLruCache *self,
+                          const char *key,
+                          gpointer    value,
+                          gint64      expires);
+
+void px_lru_cache_remove (PxLruCache *self,
+                          const char *key);
+
+void px_lru_cache_flush (PxLruCache *self);
+
+guint px_lru_cache_get_size (PxLruCache *self);
+
+G_END_DECLS
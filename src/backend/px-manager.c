@@ -25,6 +25,7 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "px-lru-cache.h"
 #include "px-manager.h"
 #include "px-plugin-config.h"
 #include "px-plugin-pacrunner.h"
@@ -70,11 +71,104 @@ enum {
   PROP_CONFIG_PLUGIN,
   PROP_CONFIG_OPTION,
   PROP_FORCE_ONLINE,
+  PROP_CACHE_SIZE,
+  PROP_CACHE_TTL,
+  PROP_PAC_POOL_SIZE,
+  PROP_DISK_CACHE,
+  PROP_PAC_TIMEOUT,
+  PROP_PAC_MEMORY_LIMIT,
+  PROP_PAC_URL,
   LAST_PROP
 };
 
 static GParamSpec *obj_properties[LAST_PROP];
 
+/* Number of PAC files kept loaded at the same time */
+#define PX_MANAGER_PAC_SLOTS 4
+
+/* Default memory limit of a single PAC evaluation context */
+#define PX_MANAGER_PAC_MEMORY_LIMIT (64 * 1024 * 1024)
+
+/*
+ * PxPacEntry:
+ *
+ * A loaded PAC file together with the runners it is compiled into. Entries
+ * are immutable once published, except for the last use time which is only
+ * used to pick an entry for eviction.
+ */
+typedef struct {
+  gatomicrefcount ref_count;
+
+  char *url;
+  gboolean wpad;
+  GBytes *data;
+  GList *runners;
+
+  /* HTTP validators and freshness of data */
+  char *etag;
+  char *last_modified;
+  gint64 expires;
+  gboolean stale;
+
+  /* Value of pac_uses at the last lookup, updated atomically */
+  gint last_used;
+} PxPacEntry;
+
+/*
+ * PxManagerState:
+ *
+ * Immutable, reference counted snapshot of the network and PAC state used
+ * by lookups. Readers take a reference with px_manager_acquire_state(),
+ * writers build a new snapshot and publish it with
+ * px_manager_publish_state().
+ */
+typedef struct {
+  gatomicrefcount ref_count;
+
+  guint generation;
+  gboolean online;
+  GPtrArray *pacs;
+
+  /* Part of the result cache keys, bumped whenever results become invalid */
+  guint cache_generation;
+} PxManagerState;
+
+typedef struct {
+  char *pac_url;
+  gboolean wpad;
+} PxRefreshJob;
+
+static void px_refresh_job_free (PxRefreshJob *job);
+
+/* A PAC download in progress, which other fetches of the same url wait for.
+ * Protected by pac_mutex. */
+typedef struct {
+  guint ref_count;
+  gboolean done;
+  PxPacEntry *entry;
+} PxPacFetch;
+
+/* Response headers relevant for caching the PAC file */
+typedef struct {
+  long status;
+  char *etag;
+  char *last_modified;
+  char *date;
+  char *expires;
+  gint64 max_age;
+  gint64 lifetime;
+} PxPacHeaders;
+
+/* Delay before retrying a PAC download after the first failure, doubled
+ * on every further failure up to the maximum */
+#define PX_PAC_BACKOFF_MIN (5 * G_TIME_SPAN_SECOND)
+#define PX_PAC_BACKOFF_MAX (10 * G_TIME_SPAN_MINUTE)
+
+typedef struct {
+  guint failures;
+  gint64 retry_after;
+} PxPacBackoff;
+
 /**
  * PxManager:
  *
@@ -84,39 +178,304 @@ static GParamSpec *obj_properties[LAST_PROP];
 struct _PxManager {
   GObject parent_instance;
   GList *config_plugins;
+  gboolean config_needs_full_url;
   GList *pacrunner_plugins;
   GNetworkMonitor *network_monitor;
 #ifdef HAVE_CURL
-  CURL *curl;
+  /* Idle curl handles, kept to reuse their connections */
+  GPtrArray *curl_handles;
 #endif
 
   char *config_plugin;
   char *config_option;
 
   gboolean force_online;
-  gboolean online;
-  gboolean wpad;
-  GBytes *pac_data;
-  char *pac_url;
 
-  GMutex mutex;
+  PxManagerState *state;
+
+  PxLruCache *cache;
+  guint cache_size;
+  guint cache_ttl;
+  guint cache_hits;
+  guint cache_misses;
+
+  guint pac_pool_size;
+  gboolean disk_cache;
+  char *disk_cache_dir;
+  guint pac_timeout;
+  guint pac_timeouts;
+  guint64 pac_memory_limit;
+  PxManagerPacUrl pac_url;
+  GThreadPool *lookup_pool;
+
+  GHashTable *pac_backoff;
+  guint pac_downloads;
+  guint pac_not_modified;
+  guint pac_compiles_skipped;
+
+  GThreadPool *refresh_pool;
+  GCancellable *refresh_cancellable;
+  GHashTable *refresh_pending;
+  GHashTable *pac_fetches;
+
+  gint pac_uses;
+
+  GMutex state_mutex;
+  GMutex state_ref_mutex;
+  GMutex pac_mutex;
+  GCond pac_cond;
+  GMutex curl_mutex;
+  GMutex backoff_mutex;
+  GMutex refresh_mutex;
 };
 
 G_DEFINE_TYPE (PxManager, px_manager, G_TYPE_OBJECT)
 
+GType
+px_manager_pac_url_get_type (void)
+{
+  static gsize type = 0;
+
+  if (g_once_init_enter (&type)) {
+    static const GEnumValue values[] = {
+      { PX_MANAGER_PAC_URL_FULL, "PX_MANAGER_PAC_URL_FULL", "full" },
+      { PX_MANAGER_PAC_URL_STRIP_HTTPS, "PX_MANAGER_PAC_URL_STRIP_HTTPS", "strip-https" },
+      { PX_MANAGER_PAC_URL_STRIP_ALL, "PX_MANAGER_PAC_URL_STRIP_ALL", "strip-all" },
+      { 0, NULL, NULL }
+    };
+
+    g_once_init_leave (&type, g_enum_register_static ("PxManagerPacUrl", values));
+  }
+
+  return type;
+}
+
+static void px_manager_lookup_thread (gpointer data,
+                                      gpointer user_data);
+static void px_manager_refresh_thread (gpointer data,
+                                       gpointer user_data);
+static void px_manager_schedule_refresh (PxManager  *self,
+                                         const char *pac_url,
+                                         gboolean    wpad);
+
+static PxPacEntry *
+px_pac_entry_new (const char *url,
+                  gboolean    wpad,
+                  GBytes     *data,
+                  GList      *runners)
+{
+  PxPacEntry *entry = g_new0 (PxPacEntry, 1);
+
+  g_atomic_ref_count_init (&entry->ref_count);
+  entry->url = g_strdup (url);
+  entry->wpad = wpad;
+  entry->data = g_bytes_ref (data);
+  entry->runners = runners;
+
+  return entry;
+}
+
+static GList *
+px_pac_entry_copy_runners (PxPacEntry *entry)
+{
+  GList *runners = NULL;
+
+  for (GList *list = entry->runners; list; list = list->next)
+    runners = g_list_append (runners, g_object_ref (list->data));
+
+  return runners;
+}
+
+static PxPacEntry *
+px_pac_entry_copy (PxPacEntry *entry)
+{
+  PxPacEntry *copy;
+
+  copy = px_pac_entry_new (entry->url, entry->wpad, entry->data, px_pac_entry_copy_runners (entry));
+
+  copy->etag = g_strdup (entry->etag);
+  copy->last_modified = g_strdup (entry->last_modified);
+  copy->expires = entry->expires;
+  copy->stale = entry->stale;
+  copy->last_used = g_atomic_int_get (&entry->last_used);
+
+  return copy;
+}
+
+static PxPacEntry *
+px_pac_entry_ref (PxPacEntry *entry)
+{
+  g_atomic_ref_count_inc (&entry->ref_count);
+  return entry;
+}
+
+static void
+px_pac_entry_unref (PxPacEntry *entry)
+{
+  if (!g_atomic_ref_count_dec (&entry->ref_count))
+    return;
+
+  g_clear_pointer (&entry->url, g_free);
+  g_clear_pointer (&entry->data, g_bytes_unref);
+  g_clear_list (&entry->runners, g_object_unref);
+  g_clear_pointer (&entry->etag, g_free);
+  g_clear_pointer (&entry->last_modified, g_free);
+  g_free (entry);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PxPacEntry, px_pac_entry_unref)
+
+static PxManagerState *
+px_manager_state_new (void)
+{
+  PxManagerState *state = g_new0 (PxManagerState, 1);
+
+  g_atomic_ref_count_init (&state->ref_count);
+  state->pacs = g_ptr_array_new_with_free_func ((GDestroyNotify)px_pac_entry_unref);
+
+  return state;
+}
+
+static PxManagerState *
+px_manager_state_copy (PxManagerState *state)
+{
+  PxManagerState *copy = px_manager_state_new ();
+
+  copy->generation = state->generation;
+  copy->cache_generation = state->cache_generation;
+  copy->online = state->online;
+  for (guint idx = 0; idx < state->pacs->len; idx++)
+    g_ptr_array_add (copy->pacs, px_pac_entry_ref (g_ptr_array_index (state->pacs, idx)));
+
+  return copy;
+}
+
+static PxManagerState *
+px_manager_state_ref (PxManagerState *state)
+{
+  g_atomic_ref_count_inc (&state->ref_count);
+  return state;
+}
+
+static void
+px_manager_state_unref (PxManagerState *state)
+{
+  if (!g_atomic_ref_count_dec (&state->ref_count))
+    return;
+
+  g_clear_pointer (&state->pacs, g_ptr_array_unref);
+  g_free (state);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PxManagerState, px_manager_state_unref)
+
+/*
+ * Take a reference on the current state. The lock is only held while
+ * loading and referencing the pointer, so publishing never waits for
+ * lookups which are using a state.
+ */
+static PxManagerState *
+px_manager_acquire_state (PxManager *self)
+{
+  PxManagerState *state;
+
+  g_mutex_lock (&self->state_ref_mutex);
+  state = px_manager_state_ref (self->state);
+  g_mutex_unlock (&self->state_ref_mutex);
+
+  return state;
+}
+
+/*
+ * Replace the current state with @state, taking ownership of it. Lookups
+ * still holding the old state keep it alive until they are done. Must be
+ * called with state_mutex held.
+ */
+static void
+px_manager_publish_state (PxManager      *self,
+                          PxManagerState *state)
+{
+  PxManagerState *old;
+
+  g_mutex_lock (&self->state_ref_mutex);
+  old = self->state;
+  self->state = state;
+  g_mutex_unlock (&self->state_ref_mutex);
+
+  if (old)
+    px_manager_state_unref (old);
+}
+
 static void
 px_manager_on_network_changed (GNetworkMonitor *monitor,
                                gboolean         network_available,
                                gpointer         user_data)
 {
   PxManager *self = PX_MANAGER (user_data);
+  g_autoptr (PxManagerState) state = NULL;
+  PxManagerState *current;
+
+  g_debug ("%s: Network connection changed, revalidating pac data", __FUNCTION__);
+
+  /* Keep the PAC files so unchanged ones can be revalidated instead of
+   * downloaded again. They are used until then, and dropped if that fails. */
+  g_mutex_lock (&self->state_mutex);
+  current = self->state;
+  state = px_manager_state_new ();
+  state->generation = current->generation + 1;
+  state->cache_generation = current->cache_generation + 1;
+  state->online = network_available;
+  for (guint idx = 0; idx < current->pacs->len; idx++) {
+    PxPacEntry *entry = px_pac_entry_copy (g_ptr_array_index (current->pacs, idx));
+
+    entry->stale = TRUE;
+    g_ptr_array_add (state->pacs, entry);
+  }
+  px_manager_publish_state (self, px_manager_state_ref (state));
+  g_mutex_unlock (&self->state_mutex);
+
+  /* A PAC server might be reachable on the new network */
+  g_mutex_lock (&self->backoff_mutex);
+  g_hash_table_remove_all (self->pac_backoff);
+  g_mutex_unlock (&self->backoff_mutex);
+
+  if (self->cache)
+    px_lru_cache_flush (self->cache);
+
+  for (GList *list = self->pacrunner_plugins; list && list->data; list = list->next) {
+    PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (list->data);
+
+    if (ifc->network_changed)
+      ifc->network_changed (PX_PAC_RUNNER (list->data));
+  }
+
+  /* Revalidate right away instead of on the next lookup */
+  for (guint idx = 0; network_available && idx < state->pacs->len; idx++) {
+    PxPacEntry *entry = g_ptr_array_index (state->pacs, idx);
+
+    px_manager_schedule_refresh (self, entry->url, entry->wpad);
+  }
+}
+
+static void
+px_manager_on_config_changed (PxConfig *config,
+                              gpointer  user_data)
+{
+  PxManager *self = PX_MANAGER (user_data);
+  PxManagerState *next;
 
-  g_debug ("%s: Network connection changed, clearing pac data", __FUNCTION__);
+  g_debug ("%s: Configuration changed, clearing cached results", __FUNCTION__);
 
-  self->wpad = FALSE;
-  self->online = network_available;
-  g_clear_pointer (&self->pac_url, g_free);
-  g_clear_pointer (&self->pac_data, g_bytes_unref);
+  /* Lookups still running with the old configuration insert their results
+   * under the old generation, where they are never found */
+  g_mutex_lock (&self->state_mutex);
+  next = px_manager_state_copy (self->state);
+  next->cache_generation++;
+  px_manager_publish_state (self, next);
+  g_mutex_unlock (&self->state_mutex);
+
+  if (self->cache)
+    px_lru_cache_flush (self->cache);
 }
 
 static gint
@@ -146,19 +505,55 @@ px_manager_add_config_plugin (PxManager *self,
   const char *env = g_getenv ("PX_FORCE_CONFIG");
   const char *force_config = self->config_plugin ? self->config_plugin : env;
 
-  if (!force_config || g_strcmp0 (ifc->name, force_config) == 0)
+  if (!force_config || g_strcmp0 (ifc->name, force_config) == 0) {
+    g_signal_connect_object (config, "changed", G_CALLBACK (px_manager_on_config_changed), self, 0);
+    self->config_needs_full_url |= ifc->needs_full_url;
     self->config_plugins = g_list_insert_sorted (self->config_plugins, g_steal_pointer (&config), config_order_compare);
+  }
+}
+
+static guint
+px_manager_get_pac_pool_size (PxManager *self)
+{
+  return self->pac_pool_size ? self->pac_pool_size : g_get_num_processors ();
+}
+
+/*
+ * The runners in pacrunner_plugins only serve as prototypes, each loaded
+ * PAC file gets its own set of runners.
+ */
+static PxPacRunner *
+px_manager_new_pacrunner (PxManager *self,
+                          GType      type)
+{
+  return g_object_new (type,
+                       "pool-size", px_manager_get_pac_pool_size (self),
+                       "cache-dir", self->disk_cache_dir,
+                       "timeout", self->pac_timeout,
+                       "memory-limit", self->pac_memory_limit,
+                       NULL);
 }
 
 static void
 px_manager_add_pacrunner_plugin (PxManager *self,
                                  GType      type)
 {
-  PxPacRunner *pacrunner = g_object_new (type, NULL);
+  PxPacRunner *pacrunner = px_manager_new_pacrunner (self, type);
 
   self->pacrunner_plugins = g_list_append (self->pacrunner_plugins, pacrunner);
 }
 
+static GList *
+px_manager_create_pacrunners (PxManager *self)
+{
+  GList *runners = NULL;
+
+  for (GList *list = self->pacrunner_plugins; list && list->data; list = list->next)
+    runners = g_list_append (runners, px_manager_new_pacrunner (self, G_OBJECT_TYPE (list->data)));
+
+  return runners;
+}
+
 static void
 px_manager_constructed (GObject *object)
 {
@@ -180,6 +575,12 @@ px_manager_constructed (GObject *object)
     }
   }
 
+  /* Expect to be online until network-changed is emitted */
+  self->state = px_manager_state_new ();
+  self->state->online = TRUE;
+
+  self->cache = px_lru_cache_new (self->cache_size, (GBoxedCopyFunc)g_strdupv, (GDestroyNotify)g_strfreev);
+
 #ifdef HAVE_CONFIG_ENV
   px_manager_add_config_plugin (self, PX_CONFIG_TYPE_ENV);
 #endif
@@ -210,19 +611,24 @@ px_manager_constructed (GObject *object)
     g_debug (" - %s", ifc->name);
   }
 
+  if (self->disk_cache || g_getenv ("PX_DISK_CACHE"))
+    self->disk_cache_dir = g_build_filename (g_get_user_cache_dir (), "libproxy", NULL);
+
 #ifdef HAVE_PACRUNNER_DUKTAPE
   px_manager_add_pacrunner_plugin (self, PX_PACRUNNER_TYPE_DUKTAPE);
 #endif
 
-  self->pac_data = NULL;
+  /* Asynchronous lookups, at most one per PAC evaluation slot */
+  self->lookup_pool = g_thread_pool_new (px_manager_lookup_thread, self, px_manager_get_pac_pool_size (self), FALSE, NULL);
+
+  /* Threads refreshing PAC files off the lookup path, one per PAC slot so
+   * that a slow server does not hold up the refresh of other PACs */
+  self->refresh_cancellable = g_cancellable_new ();
+  self->refresh_pool = g_thread_pool_new_full (px_manager_refresh_thread, self, (GDestroyNotify)px_refresh_job_free, PX_MANAGER_PAC_SLOTS, FALSE, NULL);
 
   if (!self->force_online) {
     self->network_monitor = g_network_monitor_get_default ();
     g_signal_connect_object (G_OBJECT (self->network_monitor), "network-changed", G_CALLBACK (px_manager_on_network_changed), self, 0);
-
-    /* Expect to be online until network-changed is emitted */
-    self->wpad = FALSE;
-    self->online = TRUE;
   } else {
     px_manager_on_network_changed (NULL, TRUE, self);
   }
@@ -235,12 +641,31 @@ px_manager_dispose (GObject *object)
 {
   PxManager *self = PX_MANAGER (object);
 
+  /* Refresh jobs do not hold a reference, so abort and wait for them */
+  if (self->refresh_pool) {
+    g_cancellable_cancel (self->refresh_cancellable);
+    g_thread_pool_free (self->refresh_pool, TRUE, TRUE);
+    self->refresh_pool = NULL;
+  }
+  g_clear_object (&self->refresh_cancellable);
+
   g_clear_list (&self->config_plugins, g_object_unref);
   g_clear_list (&self->pacrunner_plugins, g_object_unref);
 
   g_clear_pointer (&self->config_plugin, g_free);
+  g_clear_pointer (&self->disk_cache_dir, g_free);
+  g_clear_pointer (&self->cache, px_lru_cache_free);
+  g_clear_pointer (&self->state, px_manager_state_unref);
+  /* Pending tasks keep a reference on us, so the pool is idle by now */
+  if (self->lookup_pool) {
+    g_thread_pool_free (self->lookup_pool, TRUE, FALSE);
+    self->lookup_pool = NULL;
+  }
+  g_clear_pointer (&self->pac_backoff, g_hash_table_unref);
+  g_clear_pointer (&self->refresh_pending, g_hash_table_unref);
+  g_clear_pointer (&self->pac_fetches, g_hash_table_unref);
 #ifdef HAVE_CURL
-  g_clear_pointer (&self->curl, curl_easy_cleanup);
+  g_clear_pointer (&self->curl_handles, g_ptr_array_unref);
 #endif
 
   G_OBJECT_CLASS (px_manager_parent_class)->dispose (object);
@@ -264,6 +689,27 @@ px_manager_set_property (GObject      *object,
     case PROP_FORCE_ONLINE:
       self->force_online = g_value_get_boolean (value);
       break;
+    case PROP_CACHE_SIZE:
+      self->cache_size = g_value_get_uint (value);
+      break;
+    case PROP_CACHE_TTL:
+      self->cache_ttl = g_value_get_uint (value);
+      break;
+    case PROP_PAC_POOL_SIZE:
+      self->pac_pool_size = g_value_get_uint (value);
+      break;
+    case PROP_DISK_CACHE:
+      self->disk_cache = g_value_get_boolean (value);
+      break;
+    case PROP_PAC_TIMEOUT:
+      self->pac_timeout = g_value_get_uint (value);
+      break;
+    case PROP_PAC_MEMORY_LIMIT:
+      self->pac_memory_limit = g_value_get_uint64 (value);
+      break;
+    case PROP_PAC_URL:
+      self->pac_url = g_value_get_enum (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -275,9 +721,32 @@ px_manager_get_property (GObject    *object,
                          GValue     *value,
                          GParamSpec *pspec)
 {
+  PxManager *self = PX_MANAGER (object);
+
   switch (prop_id) {
     case PROP_CONFIG_PLUGIN:
       break;
+    case PROP_CACHE_SIZE:
+      g_value_set_uint (value, self->cache_size);
+      break;
+    case PROP_CACHE_TTL:
+      g_value_set_uint (value, self->cache_ttl);
+      break;
+    case PROP_PAC_POOL_SIZE:
+      g_value_set_uint (value, self->pac_pool_size);
+      break;
+    case PROP_DISK_CACHE:
+      g_value_set_boolean (value, self->disk_cache);
+      break;
+    case PROP_PAC_TIMEOUT:
+      g_value_set_uint (value, self->pac_timeout);
+      break;
+    case PROP_PAC_MEMORY_LIMIT:
+      g_value_set_uint64 (value, self->pac_memory_limit);
+      break;
+    case PROP_PAC_URL:
+      g_value_set_enum (value, self->pac_url);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -312,12 +781,135 @@ px_manager_class_init (PxManagerClass *klass)
                                                             FALSE,
                                                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * PxManager:cache-size:
+   *
+   * Maximum number of proxy results kept in the result cache. A value of
+   * 0 disables the cache.
+   */
+  obj_properties[PROP_CACHE_SIZE] = g_param_spec_uint ("cache-size",
+                                                       NULL,
+                                                       NULL,
+                                                       0,
+                                                       G_MAXUINT,
+                                                       256,
+                                                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:cache-ttl:
+   *
+   * Time in seconds a proxy result stays in the result cache.
+   */
+  obj_properties[PROP_CACHE_TTL] = g_param_spec_uint ("cache-ttl",
+                                                      NULL,
+                                                      NULL,
+                                                      0,
+                                                      G_MAXUINT,
+                                                      30,
+                                                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:pac-pool-size:
+   *
+   * Maximum number of PAC evaluations running in parallel. Each one needs
+   * its own javascript heap, which is only created once it is needed. A
+   * value of 0 uses the number of processors.
+   */
+  obj_properties[PROP_PAC_POOL_SIZE] = g_param_spec_uint ("pac-pool-size",
+                                                          NULL,
+                                                          NULL,
+                                                          0,
+                                                          G_MAXUINT,
+                                                          0,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:disk-cache:
+   *
+   * Keep the last working PAC file of each url in the user cache directory,
+   * so that new processes do not have to wait for the download. Can also be
+   * enabled by setting the PX_DISK_CACHE environment variable.
+   */
+  obj_properties[PROP_DISK_CACHE] = g_param_spec_boolean ("disk-cache",
+                                                          NULL,
+                                                          NULL,
+                                                          FALSE,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:pac-timeout:
+   *
+   * Time in milliseconds a single PAC evaluation may take before it is
+   * aborted and the url is treated as not needing a proxy. A value of 0
+   * disables the limit.
+   *
+   * With a stock duktape the limit only interrupts a PAC while it allocates
+   * memory. A PAC looping without allocating keeps its lookup thread busy
+   * for good; duktape has to be built with DUK_USE_EXEC_TIMEOUT_CHECK
+   * calling px_duktape_exec_timeout_check() to interrupt such loops.
+   */
+  obj_properties[PROP_PAC_TIMEOUT] = g_param_spec_uint ("pac-timeout",
+                                                        NULL,
+                                                        NULL,
+                                                        0,
+                                                        G_MAXUINT,
+                                                        10000,
+                                                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:pac-memory-limit:
+   *
+   * Maximum number of bytes each PAC evaluation context may allocate.
+   * Evaluations exceeding it fail and the url is treated as not needing a
+   * proxy. A value of 0 disables the limit.
+   */
+  obj_properties[PROP_PAC_MEMORY_LIMIT] = g_param_spec_uint64 ("pac-memory-limit",
+                                                               NULL,
+                                                               NULL,
+                                                               0,
+                                                               G_MAXUINT64,
+                                                               PX_MANAGER_PAC_MEMORY_LIMIT,
+                                                               G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * PxManager:pac-url:
+   *
+   * How much of a url PAC files get to see. Stripping path and query like
+   * browsers do keeps them from PAC files, and results are then cached per
+   * origin instead of per url.
+   */
+  obj_properties[PROP_PAC_URL] = g_param_spec_enum ("pac-url",
+                                                    NULL,
+                                                    NULL,
+                                                    PX_TYPE_MANAGER_PAC_URL,
+                                                    PX_MANAGER_PAC_URL_FULL,
+                                                    G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, LAST_PROP, obj_properties);
 }
 
 static void
 px_manager_init (PxManager *self)
 {
+  self->cache_size = 256;
+  self->cache_ttl = 30;
+  self->pac_timeout = 10000;
+  self->pac_memory_limit = PX_MANAGER_PAC_MEMORY_LIMIT;
+
+  g_mutex_init (&self->state_mutex);
+  g_mutex_init (&self->state_ref_mutex);
+  g_mutex_init (&self->pac_mutex);
+  g_cond_init (&self->pac_cond);
+  g_mutex_init (&self->curl_mutex);
+  g_mutex_init (&self->backoff_mutex);
+  g_mutex_init (&self->refresh_mutex);
+
+  self->pac_backoff = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->refresh_pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->pac_fetches = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+#ifdef HAVE_CURL
+  self->curl_handles = g_ptr_array_new_with_free_func ((GDestroyNotify)curl_easy_cleanup);
+#endif
 }
 
 /**
@@ -372,83 +964,288 @@ store_data (void   *contents,
 }
 #endif
 
-/**
- * px_manager_pac_download:
- * @self: a px manager
- * @uri: PAC uri
- *
- * Downloads a PAC file from provided @url.
- *
- * Returns: (nullable): a newly created `GBytes` containing PAC data, or %NULL on error.
- */
-GBytes *
-px_manager_pac_download (PxManager  *self,
-                         const char *uri)
+static void
+px_pac_headers_clear (PxPacHeaders *headers)
+{
+  g_clear_pointer (&headers->etag, g_free);
+  g_clear_pointer (&headers->last_modified, g_free);
+  g_clear_pointer (&headers->date, g_free);
+  g_clear_pointer (&headers->expires, g_free);
+  headers->status = 0;
+  headers->max_age = -1;
+  headers->lifetime = -1;
+}
+
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (PxPacHeaders, px_pac_headers_clear)
+
+static void
+px_pac_headers_set (char       **field,
+                    const char  *value)
 {
+  g_free (*field);
+  *field = g_strdup (value);
+}
+
 #ifdef HAVE_CURL
-  GByteArray *byte_array = g_byte_array_new ();
-  CURLcode res;
-  const char *url = uri;
+static int
+px_manager_download_progress (void       *user_pointer,
+                              curl_off_t  dltotal,
+                              curl_off_t  dlnow,
+                              curl_off_t  ultotal,
+                              curl_off_t  ulnow)
+{
+  GCancellable *cancellable = user_pointer;
 
-  if (!self->curl)
-    self->curl = curl_easy_init ();
+  /* A non zero return value aborts the transfer */
+  return g_cancellable_is_cancelled (cancellable);
+}
 
-  if (!self->curl)
-    return NULL;
+static void
+px_pac_headers_parse_cache_control (PxPacHeaders *headers,
+                                    const char   *value)
+{
+  g_auto (GStrv) directives = g_strsplit (value, ",", -1);
+
+  for (int idx = 0; directives[idx]; idx++) {
+    char *directive = g_strstrip (directives[idx]);
+
+    if (g_ascii_strncasecmp (directive, "max-age=", 8) == 0)
+      headers->max_age = MAX (g_ascii_strtoll (directive + 8, NULL, 10), 0);
+    else if (g_ascii_strcasecmp (directive, "no-cache") == 0 || g_ascii_strcasecmp (directive, "no-store") == 0)
+      headers->max_age = 0;
+  }
+}
+
+static size_t
+store_header (char   *buffer,
+              size_t  size,
+              size_t  nitems,
+              void   *user_pointer)
+{
+  PxPacHeaders *headers = user_pointer;
+  size_t real_size = size * nitems;
+  g_autofree char *line = g_strndup (buffer, real_size);
+  char *value;
+
+  /* A new status line starts the headers of a redirect target */
+  if (g_str_has_prefix (line, "HTTP/")) {
+    px_pac_headers_clear (headers);
+    return real_size;
+  }
+
+  value = strchr (line, ':');
+  if (!value)
+    return real_size;
+
+  *value++ = '\0';
+  value = g_strstrip (value);
+
+  if (g_ascii_strcasecmp (line, "ETag") == 0)
+    px_pac_headers_set (&headers->etag, value);
+  else if (g_ascii_strcasecmp (line, "Last-Modified") == 0)
+    px_pac_headers_set (&headers->last_modified, value);
+  else if (g_ascii_strcasecmp (line, "Date") == 0)
+    px_pac_headers_set (&headers->date, value);
+  else if (g_ascii_strcasecmp (line, "Expires") == 0)
+    px_pac_headers_set (&headers->expires, value);
+  else if (g_ascii_strcasecmp (line, "Cache-Control") == 0)
+    px_pac_headers_parse_cache_control (headers, value);
+
+  return real_size;
+}
+
+/*
+ * Freshness lifetime in seconds according to RFC 9111, or -1 if the
+ * server did not specify one.
+ */
+static gint64
+px_pac_headers_get_lifetime (PxPacHeaders *headers)
+{
+  time_t expires;
+  time_t date;
+
+  if (headers->max_age >= 0)
+    return headers->max_age;
+
+  if (!headers->expires)
+    return -1;
+
+  /* Invalid dates, like "0", mean already expired */
+  expires = curl_getdate (headers->expires, NULL);
+  if (expires == -1)
+    return 0;
+
+  date = headers->date ? curl_getdate (headers->date, NULL) : -1;
+  if (date == -1)
+    date = time (NULL);
+
+  return MAX (expires - date, 0);
+}
+
+static GBytes *
+px_manager_pac_download_curl (CURL         *curl,
+                              const char   *uri,
+                              const char   *etag,
+                              const char   *last_modified,
+                              PxPacHeaders *headers,
+                              GCancellable *cancellable)
+{
+  g_autoptr (GByteArray) byte_array = g_byte_array_new ();
+  g_auto (PxPacHeaders) local_headers = { 0, };
+  struct curl_slist *request_headers = NULL;
+  CURLcode res;
+  const char *url = uri;
 
   if (g_str_has_prefix (url, "pac+"))
     url += 4;
 
-  if (curl_easy_setopt (self->curl, CURLOPT_NOSIGNAL, 1) != CURLE_OK)
+  if (curl_easy_setopt (curl, CURLOPT_NOSIGNAL, 1) != CURLE_OK)
     g_debug ("Could not set NOSIGNAL, continue");
 
-  if (curl_easy_setopt (self->curl, CURLOPT_FOLLOWLOCATION, 1) != CURLE_OK)
+  if (curl_easy_setopt (curl, CURLOPT_FOLLOWLOCATION, 1) != CURLE_OK)
     g_debug ("Could not set FOLLOWLOCATION, continue");
 
-  if (curl_easy_setopt (self->curl, CURLOPT_NOPROXY, "*") != CURLE_OK) {
+  if (curl_easy_setopt (curl, CURLOPT_NOPROXY, "*") != CURLE_OK) {
     g_warning ("Could not set NOPROXY, ABORT!");
     return NULL;
   }
 
-  if (curl_easy_setopt (self->curl, CURLOPT_CONNECTTIMEOUT, 30) != CURLE_OK)
+  if (curl_easy_setopt (curl, CURLOPT_CONNECTTIMEOUT, 30) != CURLE_OK)
     g_debug ("Could not set CONENCTIONTIMEOUT, continue");
 
-  if (curl_easy_setopt (self->curl, CURLOPT_USERAGENT, "libproxy") != CURLE_OK)
+  if (curl_easy_setopt (curl, CURLOPT_USERAGENT, "libproxy") != CURLE_OK)
     g_debug ("Could not set USERAGENT, continue");
 
-  if (curl_easy_setopt (self->curl, CURLOPT_URL, url) != CURLE_OK) {
+  if (curl_easy_setopt (curl, CURLOPT_URL, url) != CURLE_OK) {
     g_warning ("Could not set URL, ABORT!");
     return NULL;
   }
 
-  if (curl_easy_setopt (self->curl, CURLOPT_WRITEFUNCTION, store_data) != CURLE_OK) {
+  if (curl_easy_setopt (curl, CURLOPT_WRITEFUNCTION, store_data) != CURLE_OK) {
     g_warning ("Could not set WRITEFUNCTION, ABORT!");
     return NULL;
   }
 
-  if (curl_easy_setopt (self->curl, CURLOPT_WRITEDATA, byte_array) != CURLE_OK) {
+  if (curl_easy_setopt (curl, CURLOPT_WRITEDATA, byte_array) != CURLE_OK) {
     g_warning ("Could not set WRITEDATA, ABORT!");
     return NULL;
   }
 
-  res = curl_easy_perform (self->curl);
+  if (cancellable) {
+    curl_easy_setopt (curl, CURLOPT_XFERINFOFUNCTION, px_manager_download_progress);
+    curl_easy_setopt (curl, CURLOPT_XFERINFODATA, cancellable);
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 0L);
+  } else {
+    curl_easy_setopt (curl, CURLOPT_NOPROGRESS, 1L);
+  }
+
+  if (!headers)
+    headers = &local_headers;
+  px_pac_headers_clear (headers);
+
+  curl_easy_setopt (curl, CURLOPT_HEADERFUNCTION, store_header);
+  curl_easy_setopt (curl, CURLOPT_HEADERDATA, headers);
+
+  /* Let the server tell us that our copy is still valid */
+  if (etag) {
+    g_autofree char *header = g_strdup_printf ("If-None-Match: %s", etag);
+
+    request_headers = curl_slist_append (request_headers, header);
+  }
+
+  if (last_modified) {
+    g_autofree char *header = g_strdup_printf ("If-Modified-Since: %s", last_modified);
+
+    request_headers = curl_slist_append (request_headers, header);
+  }
+
+  curl_easy_setopt (curl, CURLOPT_HTTPHEADER, request_headers);
+
+  res = curl_easy_perform (curl);
+
+  curl_easy_setopt (curl, CURLOPT_HTTPHEADER, NULL);
+  curl_slist_free_all (request_headers);
+
   if (res != CURLE_OK) {
     g_debug ("%s: Could not download data: %s", __FUNCTION__, curl_easy_strerror (res));
     return NULL;
   }
 
-  return g_byte_array_free_to_bytes (byte_array);
+  curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &headers->status);
+  headers->lifetime = px_pac_headers_get_lifetime (headers);
+  if (headers->status == 304) {
+    g_debug ("%s: PAC %s not modified", __FUNCTION__, url);
+    return NULL;
+  }
+
+  return g_byte_array_free_to_bytes (g_steal_pointer (&byte_array));
+}
+#endif
+
+/*
+ * Download @uri. If @etag or @last_modified are given, the download is
+ * conditional and %NULL is returned with a 304 status in @headers when the
+ * server reports that the PAC did not change.
+ */
+static GBytes *
+px_manager_pac_download_full (PxManager    *self,
+                              const char   *uri,
+                              const char   *etag,
+                              const char   *last_modified,
+                              PxPacHeaders *headers,
+                              GCancellable *cancellable)
+{
+#ifdef HAVE_CURL
+  CURL *curl = NULL;
+  GBytes *bytes;
+
+  /* Each download gets its own handle, so downloads of different PACs do
+   * not wait for each other */
+  g_mutex_lock (&self->curl_mutex);
+  if (self->curl_handles->len > 0)
+    curl = g_ptr_array_steal_index_fast (self->curl_handles, self->curl_handles->len - 1);
+  g_mutex_unlock (&self->curl_mutex);
+
+  if (!curl)
+    curl = curl_easy_init ();
+
+  if (!curl)
+    return NULL;
+
+  bytes = px_manager_pac_download_curl (curl, uri, etag, last_modified, headers, cancellable);
+
+  g_mutex_lock (&self->curl_mutex);
+  g_ptr_array_add (self->curl_handles, curl);
+  g_mutex_unlock (&self->curl_mutex);
+
+  return bytes;
 #else
   return NULL;
 #endif
 }
 
 /**
- * px_manager_get_configuration:
+ * px_manager_pac_download:
  * @self: a px manager
  * @uri: PAC uri
  *
- * Get raw proxy configuration for gien @uri.
+ * Downloads a PAC file from provided @url.
+ *
+ * Returns: (nullable): a newly created `GBytes` containing PAC data, or %NULL on error.
+ */
+GBytes *
+px_manager_pac_download (PxManager  *self,
+                         const char *uri)
+{
+  return px_manager_pac_download_full (self, uri, NULL, NULL, NULL, NULL);
+}
+
+/**
+ * px_manager_get_configuration:
+ * @self: a px manager
+ * @uri: PAC uri
+ *
+ * Get raw proxy configuration for gien @uri.
  *
  * Returns: (transfer full) (nullable): a newly created `GStrv` containing configuration data for @uri.
  */
@@ -468,17 +1265,58 @@ px_manager_get_configuration (PxManager *self,
   return g_strv_builder_end (builder);
 }
 
-static void
-px_manager_run_pac (PxPacRunner  *pacrunner,
+/*
+ * Take the response of @pacrunner for @uri out of @responses, a table
+ * filled by px_manager_run_pac_batch().
+ */
+static gboolean
+px_manager_steal_pac_response (GHashTable   *responses,
+                               PxPacRunner  *pacrunner,
+                               GUri         *uri,
+                               char        **pac_response)
+{
+  GHashTable *runner_responses;
+  g_autofree char *uri_string = NULL;
+  g_autofree char *stolen_key = NULL;
+
+  if (!responses)
+    return FALSE;
+
+  runner_responses = g_hash_table_lookup (responses, pacrunner);
+  if (!runner_responses)
+    return FALSE;
+
+  uri_string = g_uri_to_string (uri);
+
+  return g_hash_table_steal_extended (runner_responses, uri_string, (gpointer *)&stolen_key, (gpointer *)pac_response);
+}
+
+/*
+ * Add the proxies @pacrunner returns for @uri to @builder. Returns %FALSE
+ * if the evaluation timed out and DIRECT was used instead.
+ */
+static gboolean
+px_manager_run_pac (PxManager    *self,
+                    PxPacRunner  *pacrunner,
                     GBytes       *pac,
                     GUri         *uri,
+                    GHashTable   *responses,
                     GStrvBuilder *builder)
 {
   PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (pacrunner);
   g_auto (GStrv) proxies_split = NULL;
-  char *pac_response;
+  g_autofree char *pac_response = NULL;
+  gboolean answered = TRUE;
 
-  pac_response = ifc->run (PX_PAC_RUNNER (pacrunner), uri);
+  if (!px_manager_steal_pac_response (responses, pacrunner, uri, &pac_response))
+    pac_response = ifc->run (PX_PAC_RUNNER (pacrunner), uri);
+
+  if (!pac_response) {
+    g_debug ("%s: PAC evaluation for %s timed out", __FUNCTION__, g_uri_get_host (uri));
+    g_atomic_int_inc (&self->pac_timeouts);
+    pac_response = g_strdup ("DIRECT");
+    answered = FALSE;
+  }
 
   /* Split line to handle multiple proxies */
   proxies_split = g_strsplit (pac_response, ";", -1);
@@ -526,143 +1364,776 @@ px_manager_run_pac (PxPacRunner  *pacrunner,
       px_strv_builder_add_proxy (builder, "direct://");
     }
   }
+
+  return answered;
 }
 
-static gboolean
-px_manager_set_pac (PxManager *self)
+/*
+ * Create runners for @pac_data. A PAC identical to one already loaded in
+ * @state, which is common after a network change, shares the warm runners
+ * of that entry instead, and @pac_data is replaced by its data so that
+ * publishing it does not count as a change. Returns %NULL if the PAC does
+ * not compile.
+ */
+static GList *
+px_manager_compile_pac (PxManager       *self,
+                        PxManagerState  *state,
+                        GBytes         **pac_data)
 {
-  GList *list;
+  GList *runners;
+
+  for (guint idx = 0; idx < state->pacs->len; idx++) {
+    PxPacEntry *entry = g_ptr_array_index (state->pacs, idx);
 
-  for (list = self->pacrunner_plugins; list && list->data; list = list->next) {
+    if (entry->data != *pac_data && g_bytes_equal (entry->data, *pac_data)) {
+      g_debug ("%s: PAC is identical to the one from %s, not compiling it again", __FUNCTION__, entry->url);
+      g_atomic_int_inc (&self->pac_compiles_skipped);
+      g_bytes_unref (*pac_data);
+      *pac_data = g_bytes_ref (entry->data);
+      return px_pac_entry_copy_runners (entry);
+    }
+  }
+
+  runners = px_manager_create_pacrunners (self);
+
+  for (GList *list = runners; list && list->data; list = list->next) {
     PxPacRunner *pacrunner = PX_PAC_RUNNER (list->data);
     PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (pacrunner);
 
-    if (!ifc->set_pac (PX_PAC_RUNNER (pacrunner), self->pac_data))
-      return FALSE;
+    if (!ifc->set_pac (PX_PAC_RUNNER (pacrunner), *pac_data)) {
+      g_list_free_full (runners, g_object_unref);
+      return NULL;
+    }
   }
 
-  return TRUE;
+  return runners;
 }
 
 static gboolean
-px_manager_expand_wpad (PxManager *self,
-                        GUri      *uri)
+px_manager_pac_is_backed_off (PxManager  *self,
+                              const char *pac_url)
 {
-  const char *scheme = g_uri_get_scheme (uri);
+  PxPacBackoff *backoff;
   gboolean ret = FALSE;
 
-  if (g_strcmp0 (scheme, "wpad") == 0) {
+  g_mutex_lock (&self->backoff_mutex);
+  backoff = g_hash_table_lookup (self->pac_backoff, pac_url);
+  if (backoff && backoff->retry_after > g_get_monotonic_time ())
     ret = TRUE;
+  g_mutex_unlock (&self->backoff_mutex);
 
-    if (!self->wpad) {
-      g_clear_pointer (&self->pac_data, g_bytes_unref);
-      g_clear_pointer (&self->pac_url, g_free);
-      self->wpad = TRUE;
-    }
+  return ret;
+}
 
-    if (!self->pac_data) {
-      GUri *wpad_url = g_uri_parse ("http://wpad/wpad.dat", G_URI_FLAGS_NONE, NULL);
-
-      g_debug ("%s: Trying to find the PAC using WPAD...", __FUNCTION__);
-      self->pac_url = g_uri_to_string (wpad_url);
-      self->pac_data = px_manager_pac_download (self, self->pac_url);
-      if (!self->pac_data) {
-        g_clear_pointer (&self->pac_url, g_free);
-        ret = FALSE;
-      } else {
-        g_debug ("%s: PAC recevied!", __FUNCTION__);
-        if (!px_manager_set_pac (self)) {
-          g_debug ("%s: Unable to set PAC from %s while online = %d!", __FUNCTION__, self->pac_url, self->online);
-          g_clear_pointer (&self->pac_url, g_free);
-          g_clear_pointer (&self->pac_data, g_bytes_unref);
-          ret = FALSE;
-        }
-      }
-    }
+/*
+ * Record a failed download of @pac_url. Retries are delayed exponentially,
+ * with +/- 25% jitter so that clients started together do not retry in
+ * lock step.
+ */
+static void
+px_manager_pac_failed (PxManager  *self,
+                       const char *pac_url)
+{
+  PxPacBackoff *backoff;
+  gint64 delay = PX_PAC_BACKOFF_MIN;
+
+  g_mutex_lock (&self->backoff_mutex);
+  backoff = g_hash_table_lookup (self->pac_backoff, pac_url);
+  if (!backoff) {
+    backoff = g_new0 (PxPacBackoff, 1);
+    g_hash_table_insert (self->pac_backoff, g_strdup (pac_url), backoff);
   }
 
-  return ret;
+  backoff->failures++;
+  for (guint idx = 1; idx < backoff->failures && delay < PX_PAC_BACKOFF_MAX; idx++)
+    delay *= 2;
+  delay = MIN (delay, PX_PAC_BACKOFF_MAX);
+  delay = delay * g_random_double_range (0.75, 1.25);
+
+  backoff->retry_after = g_get_monotonic_time () + delay;
+  g_debug ("%s: Not retrying %s for %" G_GINT64_FORMAT " ms after %u failures", __FUNCTION__, pac_url, delay / 1000, backoff->failures);
+  g_mutex_unlock (&self->backoff_mutex);
+}
+
+static void
+px_manager_pac_succeeded (PxManager  *self,
+                          const char *pac_url)
+{
+  g_mutex_lock (&self->backoff_mutex);
+  g_hash_table_remove (self->pac_backoff, pac_url);
+  g_mutex_unlock (&self->backoff_mutex);
+}
+
+static PxPacEntry *
+px_manager_state_lookup_pac (PxManagerState *state,
+                             const char     *pac_url)
+{
+  for (guint idx = 0; idx < state->pacs->len; idx++) {
+    PxPacEntry *entry = g_ptr_array_index (state->pacs, idx);
+
+    if (g_strcmp0 (entry->url, pac_url) == 0)
+      return entry;
+  }
+
+  return NULL;
 }
 
+/* Whether @entry may be used without asking the server */
 static gboolean
-px_manager_expand_pac (PxManager *self,
-                       GUri      *uri)
+px_pac_entry_is_fresh (PxPacEntry *entry)
 {
-  gboolean ret = FALSE;
-  const char *scheme = g_uri_get_scheme (uri);
+  if (entry->stale)
+    return FALSE;
 
-  if (g_str_has_prefix (scheme, "pac+")) {
-    ret = TRUE;
+  return entry->expires == 0 || entry->expires > g_get_monotonic_time ();
+}
 
-    if (self->wpad)
-      self->wpad = FALSE;
+static void
+px_pac_entry_set_freshness (PxPacEntry   *entry,
+                            PxPacHeaders *headers)
+{
+  gint64 lifetime = headers->lifetime;
+
+  /* A 304 response may update the validators */
+  if (headers->etag)
+    px_pac_headers_set (&entry->etag, headers->etag);
+  if (headers->last_modified)
+    px_pac_headers_set (&entry->last_modified, headers->last_modified);
+
+  /* Without an explicit lifetime the PAC stays valid until the network changes */
+  entry->expires = lifetime < 0 ? 0 : g_get_monotonic_time () + lifetime * G_TIME_SPAN_SECOND;
+  entry->stale = FALSE;
+}
+
+/*
+ * Publish a state where @entry replaces the entry for the same url, or is
+ * added, evicting the least recently used entry if all slots are taken.
+ * Passing %NULL for @entry removes the entry for @pac_url instead. Nothing
+ * is published if the network changed since @generation.
+ */
+static void
+px_manager_publish_pac (PxManager  *self,
+                        guint       generation,
+                        const char *pac_url,
+                        PxPacEntry *entry)
+{
+  PxManagerState *current;
+  PxManagerState *next;
+  PxPacEntry *old;
+  gboolean changed;
+
+  g_mutex_lock (&self->state_mutex);
+
+  current = self->state;
+  if (current->generation != generation) {
+    g_mutex_unlock (&self->state_mutex);
+    return;
+  }
+
+  next = px_manager_state_copy (current);
+  old = px_manager_state_lookup_pac (next, pac_url);
+  /* A revalidated entry shares the PAC data of the one it replaces */
+  changed = !old || !entry || old->data != entry->data;
+  if (old)
+    g_ptr_array_remove (next->pacs, old);
 
-    if (self->pac_data) {
-      g_autofree char *uri_str = g_uri_to_string (uri);
+  if (entry) {
+    if (next->pacs->len >= PX_MANAGER_PAC_SLOTS) {
+      PxPacEntry *lru = g_ptr_array_index (next->pacs, 0);
 
-      if (g_strcmp0 (self->pac_url, uri_str) != 0) {
-        g_clear_pointer (&self->pac_url, g_free);
-        g_clear_pointer (&self->pac_data, g_bytes_unref);
+      for (guint idx = 1; idx < next->pacs->len; idx++) {
+        PxPacEntry *candidate = g_ptr_array_index (next->pacs, idx);
+
+        if (g_atomic_int_get (&candidate->last_used) < g_atomic_int_get (&lru->last_used))
+          lru = candidate;
       }
+
+      g_debug ("%s: Evicting PAC %s", __FUNCTION__, lru->url);
+      g_ptr_array_remove (next->pacs, lru);
     }
 
-    if (!self->pac_data) {
-      self->pac_url = g_uri_to_string (uri);
-      self->pac_data = px_manager_pac_download (self, self->pac_url);
-
-      if (!self->pac_data) {
-        g_warning ("%s: Unable to download PAC from %s while online = %d!", __FUNCTION__, self->pac_url, self->online);
-        g_clear_pointer (&self->pac_url, g_free);
-        ret = FALSE;
-      } else {
-        g_debug ("%s: PAC recevied!", __FUNCTION__);
-        if (!px_manager_set_pac (self)) {
-          g_warning ("%s: Unable to set PAC from %s while online = %d!", __FUNCTION__, self->pac_url, self->online);
-          g_clear_pointer (&self->pac_url, g_free);
-          g_clear_pointer (&self->pac_data, g_bytes_unref);
-          ret = FALSE;
-        }
-      }
+    g_ptr_array_add (next->pacs, px_pac_entry_ref (entry));
+  }
+
+  if (changed)
+    next->cache_generation++;
+
+  px_manager_publish_state (self, next);
+  g_mutex_unlock (&self->state_mutex);
+
+  /* Results computed with the previous PAC are no longer valid */
+  if (changed)
+    px_lru_cache_flush (self->cache);
+}
+
+/*
+ * The disk cache stores each PAC as <sha256 of url>.pac, next to a key file
+ * with its url, HTTP validators and expiry in wall clock time.
+ */
+#define PX_DISK_CACHE_GROUP "PAC"
+
+static char *
+px_manager_get_disk_cache_path (PxManager  *self,
+                                const char *pac_url,
+                                const char *extension)
+{
+  g_autofree char *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA256, pac_url, -1);
+  g_autofree char *name = g_strconcat (hash, extension, NULL);
+
+  return g_build_filename (self->disk_cache_dir, name, NULL);
+}
+
+static void
+px_manager_store_disk_pac (PxManager  *self,
+                           PxPacEntry *entry)
+{
+  g_autoptr (GKeyFile) key_file = NULL;
+  g_autoptr (GError) error = NULL;
+  g_autofree char *pac_path = NULL;
+  g_autofree char *info_path = NULL;
+  gint64 expires = 0;
+  gsize len;
+  gconstpointer data;
+
+  if (!self->disk_cache_dir)
+    return;
+
+  if (g_mkdir_with_parents (self->disk_cache_dir, 0700) != 0) {
+    g_debug ("%s: Could not create %s", __FUNCTION__, self->disk_cache_dir);
+    return;
+  }
+
+  if (entry->expires != 0)
+    expires = (g_get_real_time () + entry->expires - g_get_monotonic_time ()) / G_USEC_PER_SEC;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_string (key_file, PX_DISK_CACHE_GROUP, "Url", entry->url);
+  if (entry->etag)
+    g_key_file_set_string (key_file, PX_DISK_CACHE_GROUP, "ETag", entry->etag);
+  if (entry->last_modified)
+    g_key_file_set_string (key_file, PX_DISK_CACHE_GROUP, "LastModified", entry->last_modified);
+  g_key_file_set_int64 (key_file, PX_DISK_CACHE_GROUP, "Expires", expires);
+
+  /* Write the PAC first, the key file marks the entry as complete */
+  pac_path = px_manager_get_disk_cache_path (self, entry->url, ".pac");
+  info_path = px_manager_get_disk_cache_path (self, entry->url, ".ini");
+  data = g_bytes_get_data (entry->data, &len);
+
+  if (!g_file_set_contents (pac_path, data, len, &error) ||
+      !g_key_file_save_to_file (key_file, info_path, &error))
+    g_debug ("%s: Could not store PAC for %s: %s", __FUNCTION__, entry->url, error->message);
+}
+
+/*
+ * Load the last working PAC for @pac_url from disk. A PAC without a known
+ * expiry is loaded as expired, so it gets revalidated in the background.
+ */
+static PxPacEntry *
+px_manager_load_disk_pac (PxManager  *self,
+                          const char *pac_url,
+                          gboolean    wpad)
+{
+  g_autoptr (GKeyFile) key_file = g_key_file_new ();
+  g_autofree char *pac_path = NULL;
+  g_autofree char *info_path = NULL;
+  g_autofree char *url = NULL;
+  g_autofree char *contents = NULL;
+  g_autoptr (GBytes) pac_data = NULL;
+  g_autoptr (PxManagerState) current = NULL;
+  PxPacEntry *entry;
+  GList *runners;
+  gint64 expires;
+  gsize len;
+
+  if (!self->disk_cache_dir)
+    return NULL;
+
+  pac_path = px_manager_get_disk_cache_path (self, pac_url, ".pac");
+  info_path = px_manager_get_disk_cache_path (self, pac_url, ".ini");
+
+  if (!g_key_file_load_from_file (key_file, info_path, G_KEY_FILE_NONE, NULL))
+    return NULL;
+
+  url = g_key_file_get_string (key_file, PX_DISK_CACHE_GROUP, "Url", NULL);
+  if (g_strcmp0 (url, pac_url) != 0 || !g_file_get_contents (pac_path, &contents, &len, NULL))
+    return NULL;
+
+  pac_data = g_bytes_new_take (g_steal_pointer (&contents), len);
+
+  g_mutex_lock (&self->pac_mutex);
+
+  current = px_manager_acquire_state (self);
+  entry = px_manager_state_lookup_pac (current, pac_url);
+  if (entry) {
+    g_mutex_unlock (&self->pac_mutex);
+    return px_pac_entry_ref (entry);
+  }
+
+  runners = px_manager_compile_pac (self, current, &pac_data);
+  if (!runners) {
+    g_mutex_unlock (&self->pac_mutex);
+    return NULL;
+  }
+
+  g_debug ("%s: Using PAC for %s from disk cache", __FUNCTION__, pac_url);
+
+  entry = px_pac_entry_new (pac_url, wpad, pac_data, runners);
+  entry->last_used = g_atomic_int_add (&self->pac_uses, 1);
+  entry->etag = g_key_file_get_string (key_file, PX_DISK_CACHE_GROUP, "ETag", NULL);
+  entry->last_modified = g_key_file_get_string (key_file, PX_DISK_CACHE_GROUP, "LastModified", NULL);
+
+  expires = g_key_file_get_int64 (key_file, PX_DISK_CACHE_GROUP, "Expires", NULL);
+  entry->expires = g_get_monotonic_time () + (expires * G_USEC_PER_SEC - g_get_real_time ());
+  /* 0 would mean fresh forever */
+  if (expires == 0 || entry->expires <= 0)
+    entry->expires = 1;
+
+  px_manager_publish_pac (self, current->generation, pac_url, entry);
+
+  g_mutex_unlock (&self->pac_mutex);
+
+  return entry;
+}
+
+/*
+ * Download (or revalidate) and compile the PAC at @pac_url and publish it.
+ * Use px_manager_fetch_pac(), which makes sure there is only one download
+ * per url at a time.
+ *
+ * Returns: (transfer full) (nullable): the entry holding the PAC
+ */
+static PxPacEntry *
+px_manager_download_and_publish_pac (PxManager    *self,
+                                     const char   *pac_url,
+                                     gboolean      wpad,
+                                     GCancellable *cancellable)
+{
+  g_autoptr (GBytes) pac_data = NULL;
+  g_auto (PxPacHeaders) headers = { 0, };
+  g_autoptr (PxManagerState) current = NULL;
+  PxPacEntry *cached;
+  PxPacEntry *next;
+
+  /* Another thread might have loaded it in the meantime */
+  current = px_manager_acquire_state (self);
+  cached = px_manager_state_lookup_pac (current, pac_url);
+  if (cached && px_pac_entry_is_fresh (cached)) {
+    return px_pac_entry_ref (cached);
+  }
+
+  /* Or failed to */
+  if (px_manager_pac_is_backed_off (self, pac_url))
+    return NULL;
+
+  if (wpad)
+    g_debug ("%s: Trying to find the PAC using WPAD...", __FUNCTION__);
+
+  pac_data = px_manager_pac_download_full (self,
+                                           pac_url,
+                                           cached ? cached->etag : NULL,
+                                           cached ? cached->last_modified : NULL,
+                                           &headers,
+                                           cancellable);
+
+  if (pac_data) {
+    GList *runners;
+
+    g_atomic_int_inc (&self->pac_downloads);
+    g_debug ("%s: PAC recevied!", __FUNCTION__);
+
+    runners = px_manager_compile_pac (self, current, &pac_data);
+    if (!runners) {
+      if (wpad)
+        g_debug ("%s: Unable to set PAC from %s while online = %d!", __FUNCTION__, pac_url, current->online);
+      else
+        g_warning ("%s: Unable to set PAC from %s while online = %d!", __FUNCTION__, pac_url, current->online);
+      px_manager_pac_failed (self, pac_url);
+      return NULL;
     }
+
+    next = px_pac_entry_new (pac_url, wpad, pac_data, runners);
+    next->last_used = g_atomic_int_add (&self->pac_uses, 1);
+  } else if (cached && headers.status == 304) {
+    /* The compiled PAC is still current */
+    g_atomic_int_inc (&self->pac_not_modified);
+    next = px_pac_entry_copy (cached);
+  } else {
+    if (wpad || cached)
+      g_debug ("%s: Unable to download PAC from %s while online = %d!", __FUNCTION__, pac_url, current->online);
+    else
+      g_warning ("%s: Unable to download PAC from %s while online = %d!", __FUNCTION__, pac_url, current->online);
+
+    if (!g_cancellable_is_cancelled (cancellable))
+      px_manager_pac_failed (self, pac_url);
+
+    /* A PAC from before a network change might belong to another network */
+    if (cached && cached->stale)
+      px_manager_publish_pac (self, current->generation, pac_url, NULL);
+
+    return NULL;
   }
 
-  return ret;
+  px_manager_pac_succeeded (self, pac_url);
+  px_pac_entry_set_freshness (next, &headers);
+  px_manager_store_disk_pac (self, next);
+
+  /* Do not resurrect a PAC downloaded before the network changed */
+  px_manager_publish_pac (self, current->generation, pac_url, next);
+
+  /* Keep using the PAC we just loaded even if it was not published */
+  return next;
 }
 
-/**
- * px_manager_get_proxies_sync:
- * @self: a px manager
- * @url: a url
+/* Must be called with pac_mutex held */
+static void
+px_pac_fetch_unref (PxPacFetch *fetch)
+{
+  if (--fetch->ref_count > 0)
+    return;
+
+  g_clear_pointer (&fetch->entry, px_pac_entry_unref);
+  g_free (fetch);
+}
+
+/*
+ * Download (or revalidate) and compile the PAC at @pac_url and publish it.
+ * Concurrent fetches of the same url share one download, fetches of other
+ * urls do not wait for it.
  *
- * Get proxies for giben @url.
+ * Returns: (transfer full) (nullable): the entry holding the PAC
+ */
+static PxPacEntry *
+px_manager_fetch_pac (PxManager    *self,
+                      const char   *pac_url,
+                      gboolean      wpad,
+                      GCancellable *cancellable)
+{
+  PxPacFetch *fetch;
+  PxPacEntry *entry;
+
+  g_mutex_lock (&self->pac_mutex);
+
+  fetch = g_hash_table_lookup (self->pac_fetches, pac_url);
+  if (fetch) {
+    g_debug ("%s: Waiting for the running download of %s", __FUNCTION__, pac_url);
+    fetch->ref_count++;
+    while (!fetch->done)
+      g_cond_wait (&self->pac_cond, &self->pac_mutex);
+
+    entry = fetch->entry ? px_pac_entry_ref (fetch->entry) : NULL;
+    px_pac_fetch_unref (fetch);
+    g_mutex_unlock (&self->pac_mutex);
+
+    return entry;
+  }
+
+  fetch = g_new0 (PxPacFetch, 1);
+  fetch->ref_count = 1;
+  g_hash_table_insert (self->pac_fetches, g_strdup (pac_url), fetch);
+
+  g_mutex_unlock (&self->pac_mutex);
+
+  entry = px_manager_download_and_publish_pac (self, pac_url, wpad, cancellable);
+
+  g_mutex_lock (&self->pac_mutex);
+  g_hash_table_remove (self->pac_fetches, pac_url);
+  fetch->done = TRUE;
+  fetch->entry = entry ? px_pac_entry_ref (entry) : NULL;
+  g_cond_broadcast (&self->pac_cond);
+  px_pac_fetch_unref (fetch);
+  g_mutex_unlock (&self->pac_mutex);
+
+  return entry;
+}
+
+static void
+px_refresh_job_free (PxRefreshJob *job)
+{
+  g_free (job->pac_url);
+  g_free (job);
+}
+
+static void
+px_manager_refresh_thread (gpointer data,
+                           gpointer user_data)
+{
+  PxRefreshJob *job = data;
+  PxManager *self = user_data;
+  PxPacEntry *entry;
+
+  g_debug ("%s: Refreshing PAC %s", __FUNCTION__, job->pac_url);
+  entry = px_manager_fetch_pac (self, job->pac_url, job->wpad, self->refresh_cancellable);
+  g_clear_pointer (&entry, px_pac_entry_unref);
+
+  g_mutex_lock (&self->refresh_mutex);
+  g_hash_table_remove (self->refresh_pending, job->pac_url);
+  g_mutex_unlock (&self->refresh_mutex);
+
+  px_refresh_job_free (job);
+}
+
+/*
+ * Refresh @pac_url in the background, unless a refresh of it is already
+ * pending.
+ */
+static void
+px_manager_schedule_refresh (PxManager  *self,
+                             const char *pac_url,
+                             gboolean    wpad)
+{
+  PxRefreshJob *job;
+
+  if (px_manager_pac_is_backed_off (self, pac_url))
+    return;
+
+  g_mutex_lock (&self->refresh_mutex);
+  if (!g_hash_table_add (self->refresh_pending, g_strdup (pac_url))) {
+    g_mutex_unlock (&self->refresh_mutex);
+    return;
+  }
+  g_mutex_unlock (&self->refresh_mutex);
+
+  job = g_new0 (PxRefreshJob, 1);
+  job->pac_url = g_strdup (pac_url);
+  job->wpad = wpad;
+
+  g_thread_pool_push (self->refresh_pool, job, NULL);
+}
+
+/*
+ * Find or load the PAC for @pac_url.
  *
- * Returns: (transfer full) (nullable): a newly created `GStrv` containing proxy related information.
+ * A PAC which expired, or is from before a network change, keeps being
+ * used while it is refreshed in the background, so only the very first
+ * lookup for a PAC waits for the download. A PAC from before a network
+ * change is dropped if it cannot be revalidated.
+ *
+ * Returns: (transfer full) (nullable): the entry holding the PAC
  */
-char **
-px_manager_get_proxies_sync (PxManager  *self,
-                             const char *url)
+static PxPacEntry *
+px_manager_load_pac (PxManager      *self,
+                     PxManagerState *state,
+                     const char     *pac_url,
+                     gboolean        wpad,
+                     GCancellable   *cancellable)
+{
+  PxPacEntry *entry = px_manager_state_lookup_pac (state, pac_url);
+
+  if (entry) {
+    g_atomic_int_set (&entry->last_used, g_atomic_int_add (&self->pac_uses, 1));
+
+    if (!px_pac_entry_is_fresh (entry))
+      px_manager_schedule_refresh (self, pac_url, wpad);
+
+    return px_pac_entry_ref (entry);
+  }
+
+  /* Start with the last known good PAC and revalidate it later */
+  entry = px_manager_load_disk_pac (self, pac_url, wpad);
+  if (entry) {
+    if (!px_pac_entry_is_fresh (entry))
+      px_manager_schedule_refresh (self, pac_url, wpad);
+    return entry;
+  }
+
+  /* Fail fast instead of waiting for another timeout */
+  if (px_manager_pac_is_backed_off (self, pac_url)) {
+    g_debug ("%s: Skipping download of %s, backing off", __FUNCTION__, pac_url);
+    return NULL;
+  }
+
+  return px_manager_fetch_pac (self, pac_url, wpad, cancellable);
+}
+
+/*
+ * Load the PAC referred to by a "wpad://" or "pac+" configuration entry.
+ *
+ * Returns: (transfer full) (nullable): the entry holding the PAC
+ */
+static PxPacEntry *
+px_manager_expand_pac (PxManager      *self,
+                       PxManagerState *state,
+                       GUri           *uri,
+                       GCancellable   *cancellable)
+{
+  const char *scheme = g_uri_get_scheme (uri);
+  g_autofree char *pac_url = NULL;
+
+  if (g_strcmp0 (scheme, "wpad") == 0)
+    return px_manager_load_pac (self, state, "http://wpad/wpad.dat", TRUE, cancellable);
+
+  if (!g_str_has_prefix (scheme, "pac+"))
+    return NULL;
+
+  pac_url = g_uri_to_string (uri);
+
+  return px_manager_load_pac (self, state, pac_url, FALSE, cancellable);
+}
+
+/*
+ * The url passed to PAC files for @uri, according to PxManager:pac-url.
+ * Stripped urls keep scheme, host and port only.
+ */
+static GUri *
+px_manager_get_pac_uri (PxManager *self,
+                        GUri      *uri)
+{
+  const char *scheme = g_uri_get_scheme (uri);
+  gboolean strip;
+
+  switch (self->pac_url) {
+    case PX_MANAGER_PAC_URL_STRIP_HTTPS:
+      strip = g_ascii_strcasecmp (scheme, "https") == 0 || g_ascii_strcasecmp (scheme, "wss") == 0;
+      break;
+    case PX_MANAGER_PAC_URL_STRIP_ALL:
+      strip = g_uri_get_host (uri) != NULL;
+      break;
+    case PX_MANAGER_PAC_URL_FULL:
+    default:
+      strip = FALSE;
+      break;
+  }
+
+  if (!strip)
+    return g_uri_ref (uri);
+
+  return g_uri_build (G_URI_FLAGS_NONE, scheme, NULL, g_uri_get_host (uri), g_uri_get_port (uri), "/", NULL, NULL);
+}
+
+/*
+ * Results are cached per (scheme, host, port, path and query). User
+ * information and fragments are not part of the key, and host names are
+ * compared case insensitively. The cache generation of @state keeps
+ * results of lookups which raced with a change from being found later.
+ */
+static char *
+px_manager_get_cache_key (PxManagerState *state,
+                          GUri           *uri)
+{
+  g_autofree char *host = g_ascii_strdown (g_uri_get_host (uri) ? g_uri_get_host (uri) : "", -1);
+  const char *query = g_uri_get_query (uri);
+
+  return g_strdup_printf ("%u:%s://%s:%d%s%s%s",
+                          state->cache_generation,
+                          g_uri_get_scheme (uri),
+                          host,
+                          g_uri_get_port (uri),
+                          g_uri_get_path (uri),
+                          query ? "?" : "",
+                          query ? query : "");
+}
+
+/*
+ * Most configuration plugins only look at scheme, host and port of the url
+ * (ignore lists may contain ports), so their result is shared by all urls
+ * with the same key. Path and query are part of the key as soon as one
+ * plugin needs the full url.
+ */
+static char *
+px_manager_get_config_key (PxManager *self,
+                           GUri      *uri)
+{
+  g_autofree char *host = g_ascii_strdown (g_uri_get_host (uri) ? g_uri_get_host (uri) : "", -1);
+  const char *query = g_uri_get_query (uri);
+
+  if (!self->config_needs_full_url)
+    return g_strdup_printf ("%s://%s:%d", g_uri_get_scheme (uri), host, g_uri_get_port (uri));
+
+  return g_strdup_printf ("%s://%s:%d%s%s%s",
+                          g_uri_get_scheme (uri),
+                          host,
+                          g_uri_get_port (uri),
+                          g_uri_get_path (uri),
+                          query ? "?" : "",
+                          query ? query : "");
+}
+
+/*
+ * The cache key for the result of @uri. Results only depend on the part of
+ * the url PAC files see in @pac_uri, unless a configuration plugin needs
+ * the full url.
+ */
+static char *
+px_manager_get_result_key (PxManager      *self,
+                           PxManagerState *state,
+                           GUri           *uri,
+                           GUri           *pac_uri)
+{
+  return px_manager_get_cache_key (state, self->config_needs_full_url ? uri : pac_uri);
+}
+
+/*
+ * Get the configuration for @uri from @configs, the configurations already
+ * computed by earlier lookups of the same batch, or compute and add it.
+ */
+static char **
+px_manager_get_batch_configuration (PxManager  *self,
+                                    GUri       *uri,
+                                    GHashTable *configs)
+{
+  g_autofree char *config_key = px_manager_get_config_key (self, uri);
+  char **config;
+
+  config = g_hash_table_lookup (configs, config_key);
+  if (!config) {
+    config = px_manager_get_configuration (self, uri);
+    g_hash_table_insert (configs, g_steal_pointer (&config_key), config);
+  }
+
+  return config;
+}
+
+/*
+ * Resolve @url using the snapshot in @state. @configs is an optional table
+ * of configurations already computed by earlier lookups of the same batch,
+ * @responses an optional table of PAC responses computed for the batch by
+ * px_manager_run_pac_batch().
+ */
+static char **
+px_manager_lookup (PxManager      *self,
+                   PxManagerState *state,
+                   const char     *url,
+                   GHashTable     *configs,
+                   GHashTable     *responses,
+                   GCancellable   *cancellable)
 {
   g_autoptr (GStrvBuilder) builder = NULL;
   g_autoptr (GUri) uri = NULL;
-  g_auto (GStrv) config = NULL;
+  g_autoptr (GUri) pac_uri = NULL;
+  g_auto (GStrv) owned_config = NULL;
   g_autoptr (GError) error = NULL;
-
-  g_mutex_lock (&self->mutex);
+  g_autofree char *cache_key = NULL;
+  gboolean fallback = FALSE;
+  char **config;
+  char **result;
 
   builder = g_strv_builder_new ();
   uri = g_uri_parse (url, G_URI_FLAGS_NONE, &error);
 
-  g_debug ("%s: url=%s online=%d", __FUNCTION__, url ? url : "?", self->online);
-  if (!uri || !self->online) {
+  g_debug ("%s: url=%s online=%d", __FUNCTION__, url ? url : "?", state->online);
+  if (!uri || !state->online) {
     px_strv_builder_add_proxy (builder, "direct://");
-    g_mutex_unlock (&self->mutex);
     return g_strv_builder_end (builder);
   }
 
-  config = px_manager_get_configuration (self, uri);
+  pac_uri = px_manager_get_pac_uri (self, uri);
+  cache_key = px_manager_get_result_key (self, state, uri, pac_uri);
+  result = px_lru_cache_lookup (self->cache, cache_key);
+  if (result) {
+    g_debug ("%s: Using cached result for %s", __FUNCTION__, cache_key);
+    g_atomic_int_inc (&self->cache_hits);
+    return result;
+  }
+  g_atomic_int_inc (&self->cache_misses);
+
+  if (configs)
+    config = px_manager_get_batch_configuration (self, uri, configs);
+  else
+    config = owned_config = px_manager_get_configuration (self, uri);
 
   for (int idx = 0; idx < g_strv_length (config); idx++) {
-    GUri *conf_url = g_uri_parse (config[idx], G_URI_FLAGS_NONE, NULL);
+    g_autoptr (GUri) conf_url = g_uri_parse (config[idx], G_URI_FLAGS_NONE, NULL);
+    g_autoptr (PxPacEntry) pac = NULL;
 
     g_debug ("%s: Config[%d] = %s", __FUNCTION__, idx, config[idx]);
 
@@ -670,16 +2141,23 @@ px_manager_get_proxies_sync (PxManager  *self,
     if (!conf_url)
       continue;
 
-    if (px_manager_expand_wpad (self, conf_url) || px_manager_expand_pac (self, conf_url)) {
+    pac = px_manager_expand_pac (self, state, conf_url, cancellable);
+    if (pac) {
       GList *list;
 
-      for (list = self->pacrunner_plugins; list && list->data; list = list->next) {
+      for (list = pac->runners; list && list->data; list = list->next) {
         PxPacRunner *pacrunner = PX_PAC_RUNNER (list->data);
 
-        px_manager_run_pac (pacrunner, self->pac_data, uri, builder);
+        if (!px_manager_run_pac (self, pacrunner, pac->data, pac_uri, responses, builder))
+          fallback = TRUE;
       }
     } else if (!g_str_has_prefix (g_uri_get_scheme (conf_url), "wpad") && !g_str_has_prefix (g_uri_get_scheme (conf_url), "pac+")) {
-      px_strv_builder_add_proxy (builder, g_uri_to_string (conf_url));
+      g_autofree char *conf_string = g_uri_to_string (conf_url);
+
+      px_strv_builder_add_proxy (builder, conf_string);
+    } else {
+      /* The PAC could not be loaded, or its download is backing off */
+      fallback = TRUE;
     }
   }
 
@@ -690,8 +2168,361 @@ px_manager_get_proxies_sync (PxManager  *self,
   for (int idx = 0; idx < ((GPtrArray *)builder)->len; idx++)
     g_debug ("%s: Proxy[%d] = %s", __FUNCTION__, idx, (char *)((GPtrArray *)builder)->pdata[idx]);
 
-  g_mutex_unlock (&self->mutex);
-  return g_strv_builder_end (builder);
+  result = g_strv_builder_end (builder);
+
+  /* A fallback would otherwise outlive the failure it stands in for */
+  if (!fallback) {
+    px_lru_cache_insert (self->cache,
+                         cache_key,
+                         g_strdupv (result),
+                         g_get_monotonic_time () + self->cache_ttl * G_TIME_SPAN_SECOND);
+  }
+
+  return result;
+}
+
+static char **
+px_manager_get_proxies_cancellable (PxManager    *self,
+                                    const char   *url,
+                                    GCancellable *cancellable)
+{
+  g_autoptr (PxManagerState) state = px_manager_acquire_state (self);
+
+  return px_manager_lookup (self, state, url, NULL, NULL, cancellable);
+}
+
+/**
+ * px_manager_get_proxies_sync:
+ * @self: a px manager
+ * @url: a url
+ *
+ * Get proxies for giben @url.
+ *
+ * Lookups only hold short locks, to reference the current state and to
+ * access the result cache, so they do not wait for each other as long as
+ * no PAC has to be downloaded.
+ *
+ * Returns: (transfer full) (nullable): a newly created `GStrv` containing proxy related information.
+ */
+char **
+px_manager_get_proxies_sync (PxManager  *self,
+                             const char *url)
+{
+  return px_manager_get_proxies_cancellable (self, url, NULL);
+}
+
+/*
+ * Evaluate the PAC files needed by the uncached @urls up front, handing all
+ * urls evaluated by the same runner to its run_batch() at once.
+ *
+ * Returns: (transfer full): a table mapping each runner to a table of url
+ *   strings and responses
+ */
+static GHashTable *
+px_manager_run_pac_batch (PxManager          *self,
+                          PxManagerState     *state,
+                          const char * const *urls,
+                          GHashTable         *configs)
+{
+  g_autoptr (GHashTable) pending = NULL;
+  GHashTable *responses;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  pending = g_hash_table_new_full (NULL, NULL, g_object_unref, (GDestroyNotify)g_hash_table_unref);
+  responses = g_hash_table_new_full (NULL, NULL, g_object_unref, (GDestroyNotify)g_hash_table_unref);
+
+  for (guint idx = 0; state->online && urls[idx]; idx++) {
+    g_autoptr (GUri) uri = g_uri_parse (urls[idx], G_URI_FLAGS_NONE, NULL);
+    g_autoptr (GUri) pac_uri = NULL;
+    g_autofree char *cache_key = NULL;
+    g_auto (GStrv) cached = NULL;
+    char **config;
+
+    if (!uri)
+      continue;
+
+    pac_uri = px_manager_get_pac_uri (self, uri);
+    cache_key = px_manager_get_result_key (self, state, uri, pac_uri);
+    cached = px_lru_cache_lookup (self->cache, cache_key);
+    if (cached)
+      continue;
+
+    config = px_manager_get_batch_configuration (self, uri, configs);
+
+    for (int conf_idx = 0; conf_idx < g_strv_length (config); conf_idx++) {
+      g_autoptr (GUri) conf_url = g_uri_parse (config[conf_idx], G_URI_FLAGS_NONE, NULL);
+      g_autoptr (PxPacEntry) pac = NULL;
+
+      if (conf_url)
+        pac = px_manager_expand_pac (self, state, conf_url, NULL);
+      if (!pac)
+        continue;
+
+      for (GList *list = pac->runners; list && list->data; list = list->next) {
+        PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (list->data);
+        GHashTable *runner_uris;
+
+        if (!ifc->run_batch)
+          continue;
+
+        runner_uris = g_hash_table_lookup (pending, list->data);
+        if (!runner_uris) {
+          runner_uris = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_uri_unref);
+          g_hash_table_insert (pending, g_object_ref (list->data), runner_uris);
+        }
+
+        g_hash_table_replace (runner_uris, g_uri_to_string (pac_uri), g_uri_ref (pac_uri));
+      }
+    }
+  }
+
+  g_hash_table_iter_init (&iter, pending);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (key);
+    g_autoptr (GPtrArray) uris = g_ptr_array_new ();
+    g_autoptr (GPtrArray) runner_results = NULL;
+    g_autofree gpointer *uri_strings = NULL;
+    GHashTable *runner_responses;
+    guint n_uris;
+
+    uri_strings = g_hash_table_get_keys_as_array (value, &n_uris);
+    for (guint idx = 0; idx < n_uris; idx++)
+      g_ptr_array_add (uris, g_hash_table_lookup (value, uri_strings[idx]));
+
+    g_debug ("%s: Evaluating %u urls at once", __FUNCTION__, n_uris);
+    runner_results = ifc->run_batch (PX_PAC_RUNNER (key), uris);
+
+    /* The responses are moved to the table */
+    g_ptr_array_set_free_func (runner_results, NULL);
+    runner_responses = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    for (guint idx = 0; idx < n_uris; idx++)
+      g_hash_table_insert (runner_responses, g_strdup (uri_strings[idx]), g_ptr_array_index (runner_results, idx));
+
+    g_hash_table_insert (responses, g_object_ref (key), runner_responses);
+  }
+
+  return responses;
+}
+
+/**
+ * px_manager_get_proxies_batch_sync:
+ * @self: a px manager
+ * @urls: (array zero-terminated=1): a %NULL-terminated array of urls
+ *
+ * Get proxies for all @urls at once. This is equivalent to calling
+ * px_manager_get_proxies_sync() for each url, but the configuration is
+ * only queried once per distinct scheme, host and port (unless a
+ * configuration plugin needs the full url), all urls are
+ * resolved against the same network and PAC state, and pacrunners which
+ * support it evaluate all urls in one go.
+ *
+ * Returns: (transfer full): a newly allocated %NULL-terminated array with
+ *   one `GStrv` per url, in the order of @urls. Free it with
+ *   px_manager_free_proxies_batch().
+ */
+char ***
+px_manager_get_proxies_batch_sync (PxManager          *self,
+                                   const char * const *urls)
+{
+  g_autoptr (PxManagerState) state = px_manager_acquire_state (self);
+  g_autoptr (GHashTable) configs = NULL;
+  g_autoptr (GHashTable) responses = NULL;
+  guint n_urls = urls ? g_strv_length ((char **)urls) : 0;
+  char ***results = g_new0 (char **, n_urls + 1);
+
+  configs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_strfreev);
+  if (n_urls > 0)
+    responses = px_manager_run_pac_batch (self, state, urls, configs);
+
+  for (guint idx = 0; idx < n_urls; idx++)
+    results[idx] = px_manager_lookup (self, state, urls[idx], configs, responses, NULL);
+
+  return results;
+}
+
+/**
+ * px_manager_free_proxies_batch:
+ * @proxies: (nullable): result of px_manager_get_proxies_batch_sync()
+ *
+ * Frees the result of a batch lookup.
+ */
+void
+px_manager_free_proxies_batch (char ***proxies)
+{
+  if (!proxies)
+    return;
+
+  for (guint idx = 0; proxies[idx]; idx++)
+    g_strfreev (proxies[idx]);
+
+  g_free (proxies);
+}
+
+/**
+ * px_manager_get_stats:
+ * @self: a px manager
+ *
+ * Get diagnostic information about the manager. The returned dictionary
+ * contains:
+ *
+ * - `cache-hits` (`u`): number of lookups answered from the result cache.
+ * - `cache-misses` (`u`): number of lookups which had to be resolved.
+ * - `pac-backoff` (`a{s(ux)}`): PAC urls which failed to download, with
+ *   the number of consecutive failures and the time in microseconds until
+ *   the next attempt (0 if a retry is allowed now).
+ * - `pac-compiles-skipped` (`u`): number of downloaded PAC files which were
+ *   identical to a loaded one and shared its runners instead of being
+ *   compiled.
+ * - `pac-downloads` (`u`): number of PAC files downloaded.
+ * - `pac-memory-peak` (`t`): highest number of bytes the runners of the
+ *   loaded PAC files have used.
+ * - `pac-memory-used` (`t`): number of bytes currently used by the runners
+ *   of the loaded PAC files.
+ * - `pac-not-modified` (`u`): number of PAC revalidations answered with
+ *   "304 Not Modified".
+ * - `pac-slots` (`as`): urls of the PAC files currently loaded.
+ * - `pac-timeouts` (`u`): number of PAC evaluations aborted because they
+ *   exceeded #PxManager:pac-timeout.
+ *
+ * Returns: (transfer floating): a `a{sv}` `GVariant`
+ */
+GVariant *
+px_manager_get_stats (PxManager *self)
+{
+  GVariantDict dict;
+  GVariantBuilder backoff_builder;
+  GVariantBuilder slots_builder;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  guint64 memory_used = 0;
+  guint64 memory_peak = 0;
+  gint64 now = g_get_monotonic_time ();
+  g_autoptr (PxManagerState) state = px_manager_acquire_state (self);
+
+  g_variant_dict_init (&dict, NULL);
+
+  g_variant_dict_insert (&dict, "cache-hits", "u", g_atomic_int_get (&self->cache_hits));
+  g_variant_dict_insert (&dict, "cache-misses", "u", g_atomic_int_get (&self->cache_misses));
+
+  g_variant_builder_init (&backoff_builder, G_VARIANT_TYPE ("a{s(ux)}"));
+  g_mutex_lock (&self->backoff_mutex);
+  g_hash_table_iter_init (&iter, self->pac_backoff);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    PxPacBackoff *backoff = value;
+
+    g_variant_builder_add (&backoff_builder, "{s(ux)}", key, backoff->failures, MAX (backoff->retry_after - now, 0));
+  }
+  g_mutex_unlock (&self->backoff_mutex);
+  g_variant_dict_insert_value (&dict, "pac-backoff", g_variant_builder_end (&backoff_builder));
+
+  g_variant_dict_insert (&dict, "pac-compiles-skipped", "u", g_atomic_int_get (&self->pac_compiles_skipped));
+  g_variant_dict_insert (&dict, "pac-downloads", "u", g_atomic_int_get (&self->pac_downloads));
+  g_variant_dict_insert (&dict, "pac-not-modified", "u", g_atomic_int_get (&self->pac_not_modified));
+
+  g_variant_builder_init (&slots_builder, G_VARIANT_TYPE_STRING_ARRAY);
+  for (guint idx = 0; idx < state->pacs->len; idx++) {
+    PxPacEntry *entry = g_ptr_array_index (state->pacs, idx);
+
+    g_variant_builder_add (&slots_builder, "s", entry->url);
+
+    for (GList *list = entry->runners; list; list = list->next) {
+      guint64 used;
+      guint64 peak;
+
+      g_object_get (list->data, "memory-used", &used, "memory-peak", &peak, NULL);
+      memory_used += used;
+      memory_peak += peak;
+    }
+  }
+  g_variant_dict_insert_value (&dict, "pac-slots", g_variant_builder_end (&slots_builder));
+
+  g_variant_dict_insert (&dict, "pac-memory-used", "t", memory_used);
+  g_variant_dict_insert (&dict, "pac-memory-peak", "t", memory_peak);
+
+  g_variant_dict_insert (&dict, "pac-timeouts", "u", g_atomic_int_get (&self->pac_timeouts));
+
+  return g_variant_dict_end (&dict);
+}
+
+static void
+px_manager_lookup_thread (gpointer data,
+                          gpointer user_data)
+{
+  g_autoptr (GTask) task = data;
+  PxManager *self = g_task_get_source_object (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  char **proxies;
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  proxies = px_manager_get_proxies_cancellable (self, g_task_get_task_data (task), cancellable);
+
+  if (g_task_return_error_if_cancelled (task)) {
+    g_strfreev (proxies);
+    return;
+  }
+
+  g_task_return_pointer (task, proxies, (GDestroyNotify)g_strfreev);
+}
+
+/**
+ * px_manager_get_proxies_async:
+ * @self: a px manager
+ * @url: a url
+ * @cancellable: (nullable): a `GCancellable`
+ * @callback: (scope async): callback to call when the lookup is done
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronously get proxies for given @url. Lookups run on a bounded pool
+ * of worker threads owned by the manager, so a slow PAC download does not
+ * block the calling thread. Cancelling @cancellable aborts a running PAC
+ * download.
+ *
+ * Call px_manager_get_proxies_finish() from @callback to get the result.
+ */
+void
+px_manager_get_proxies_async (PxManager           *self,
+                              const char          *url,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  g_autoptr (GTask) task = NULL;
+
+  g_return_if_fail (PX_IS_MANAGER (self));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, px_manager_get_proxies_async);
+  g_task_set_task_data (task, g_strdup (url), g_free);
+
+  g_thread_pool_push (self->lookup_pool, g_steal_pointer (&task), NULL);
+}
+
+/**
+ * px_manager_get_proxies_finish:
+ * @self: a px manager
+ * @result: a `GAsyncResult`
+ * @error: return location for a `GError`
+ *
+ * Finish a lookup started with px_manager_get_proxies_async().
+ *
+ * Returns: (transfer full) (nullable): a newly created `GStrv` containing proxy related information,
+ *   or %NULL if the lookup was cancelled.
+ */
+char **
+px_manager_get_proxies_finish (PxManager     *self,
+                               GAsyncResult  *result,
+                               GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == px_manager_get_proxies_async, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 void
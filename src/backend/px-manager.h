@@ -21,7 +21,7 @@
 
 #pragma once
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -36,6 +36,24 @@ typedef enum {
   PX_MANAGER_ERROR_UNKNOWN_METHOD = 1001,
 } PxManagerErrorCode;
 
+/**
+ * PxManagerPacUrl:
+ * @PX_MANAGER_PAC_URL_FULL: PAC files see the full url
+ * @PX_MANAGER_PAC_URL_STRIP_HTTPS: PAC files only see scheme, host and port
+ *   of https and wss urls
+ * @PX_MANAGER_PAC_URL_STRIP_ALL: PAC files only see scheme, host and port of
+ *   all urls
+ *
+ * How much of a url is passed to FindProxyForURL().
+ */
+typedef enum {
+  PX_MANAGER_PAC_URL_FULL,
+  PX_MANAGER_PAC_URL_STRIP_HTTPS,
+  PX_MANAGER_PAC_URL_STRIP_ALL,
+} PxManagerPacUrl;
+
+#define PX_TYPE_MANAGER_PAC_URL (px_manager_pac_url_get_type ())
+GType px_manager_pac_url_get_type (void);
 
 PxManager *px_manager_new (void);
 PxManager *px_manager_new_with_options (const char *optname1, ...);
@@ -43,6 +61,23 @@ PxManager *px_manager_new_with_options (const char *optname1, ...);
 char **px_manager_get_proxies_sync (PxManager   *self,
                                     const char  *url);
 
+void px_manager_get_proxies_async (PxManager           *self,
+                                   const char          *url,
+                                   GCancellable        *cancellable,
+                                   GAsyncReadyCallback  callback,
+                                   gpointer             user_data);
+
+char **px_manager_get_proxies_finish (PxManager     *self,
+                                      GAsyncResult  *result,
+                                      GError       **error);
+
+char ***px_manager_get_proxies_batch_sync (PxManager          *self,
+                                           const char * const *urls);
+
+void px_manager_free_proxies_batch (char ***proxies);
+
+GVariant *px_manager_get_stats (PxManager *self);
+
 GBytes *px_manager_pac_download (PxManager  *self,
                                  const char *uri);
 
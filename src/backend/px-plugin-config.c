@@ -34,4 +34,20 @@ px_config_default_init (PxConfigInterface *iface)
                                                             G_PARAM_READWRITE |
                                                             G_PARAM_CONSTRUCT_ONLY |
                                                             G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxConfig::changed:
+   *
+   * Emitted by configuration plugins which are able to detect that their
+   * configuration source has been modified.
+   */
+  g_signal_new ("changed",
+                G_TYPE_FROM_INTERFACE (iface),
+                G_SIGNAL_RUN_LAST,
+                0,
+                NULL,
+                NULL,
+                NULL,
+                G_TYPE_NONE,
+                0);
 }
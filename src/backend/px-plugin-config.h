@@ -40,6 +40,8 @@ struct _PxConfigInterface
   GTypeInterface parent_iface;
   const char *name;
   gint priority;
+  /* Whether get_config() looks at more of the url than scheme, host and port */
+  gboolean needs_full_url;
 
   void (*get_config) (PxConfig *self, GUri *uri, GStrvBuilder *builder);
 };
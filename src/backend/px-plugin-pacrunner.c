@@ -26,4 +26,98 @@ G_DEFINE_INTERFACE (PxPacRunner, px_pacrunner, G_TYPE_OBJECT)
 static void
 px_pacrunner_default_init (PxPacRunnerInterface *iface)
 {
+  /**
+   * PxPacRunner:pool-size:
+   *
+   * Maximum number of PAC evaluations the runner may perform in parallel.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_uint ("pool-size",
+                                                          NULL,
+                                                          NULL,
+                                                          1,
+                                                          G_MAXUINT,
+                                                          1,
+                                                          G_PARAM_READWRITE |
+                                                          G_PARAM_CONSTRUCT_ONLY |
+                                                          G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxPacRunner:cache-dir:
+   *
+   * Directory the runner may store compiled PAC files in, or %NULL to keep
+   * them in memory only.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_string ("cache-dir",
+                                                            NULL,
+                                                            NULL,
+                                                            NULL,
+                                                            G_PARAM_READWRITE |
+                                                            G_PARAM_CONSTRUCT_ONLY |
+                                                            G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxPacRunner:timeout:
+   *
+   * Time in milliseconds a single PAC evaluation may take, 0 for no limit.
+   * Runners may only be able to enforce it while the PAC allocates memory.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_uint ("timeout",
+                                                          NULL,
+                                                          NULL,
+                                                          0,
+                                                          G_MAXUINT,
+                                                          0,
+                                                          G_PARAM_READWRITE |
+                                                          G_PARAM_CONSTRUCT_ONLY |
+                                                          G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxPacRunner:memory-limit:
+   *
+   * Maximum number of bytes a single PAC evaluation context may use, 0 for
+   * no limit.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_uint64 ("memory-limit",
+                                                            NULL,
+                                                            NULL,
+                                                            0,
+                                                            G_MAXUINT64,
+                                                            0,
+                                                            G_PARAM_READWRITE |
+                                                            G_PARAM_CONSTRUCT_ONLY |
+                                                            G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxPacRunner:memory-used:
+   *
+   * Number of bytes currently used by the runner's evaluation contexts.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_uint64 ("memory-used",
+                                                            NULL,
+                                                            NULL,
+                                                            0,
+                                                            G_MAXUINT64,
+                                                            0,
+                                                            G_PARAM_READABLE |
+                                                            G_PARAM_STATIC_STRINGS));
+
+  /**
+   * PxPacRunner:memory-peak:
+   *
+   * Highest value #PxPacRunner:memory-used has reached.
+   */
+  g_object_interface_install_property (iface,
+                                       g_param_spec_uint64 ("memory-peak",
+                                                            NULL,
+                                                            NULL,
+                                                            0,
+                                                            G_MAXUINT64,
+                                                            0,
+                                                            G_PARAM_READABLE |
+                                                            G_PARAM_STATIC_STRINGS));
 }
@@ -34,7 +34,15 @@ struct _PxPacRunnerInterface
   GTypeInterface parent_iface;
 
   gboolean (*set_pac) (PxPacRunner *pacrunner, GBytes *pac_data);
+  /* Returns NULL if the evaluation exceeded the time limit */
   char *(*run) (PxPacRunner *self, GUri *uri);
+
+  /* Optional: drop state which depends on the network, like cached DNS results */
+  void (*network_changed) (PxPacRunner *self);
+
+  /* Optional: evaluate the GUri array @uris in one go, returning an array
+   * with the result of run() for each of them */
+  GPtrArray *(*run_batch) (PxPacRunner *self, GPtrArray *uris);
 };
 
 G_END_DECLS
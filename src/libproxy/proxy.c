@@ -62,6 +62,37 @@ px_proxy_factory_get_proxies (pxProxyFactory *self,
   return g_steal_pointer (&result);
 }
 
+void
+px_proxy_factory_get_proxies_async (pxProxyFactory      *self,
+                                    const char          *url,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  px_manager_get_proxies_async (self->manager, url, cancellable, callback, user_data);
+}
+
+char **
+px_proxy_factory_get_proxies_finish (pxProxyFactory  *self,
+                                     GAsyncResult    *result,
+                                     GError         **error)
+{
+  return px_manager_get_proxies_finish (self->manager, result, error);
+}
+
+char ***
+px_proxy_factory_get_proxies_batch (pxProxyFactory     *self,
+                                    const char * const *urls)
+{
+  return px_manager_get_proxies_batch_sync (self->manager, urls);
+}
+
+void
+px_proxy_factory_free_proxies_batch (char ***proxies)
+{
+  px_manager_free_proxies_batch (proxies);
+}
+
 void
 px_proxy_factory_free_proxies (char **proxies)
 {
@@ -22,7 +22,7 @@
 
 #pragma once
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -118,6 +118,83 @@ GType           px_proxy_factory_get_type (void) G_GNUC_CONST;
  */
 char **px_proxy_factory_get_proxies (pxProxyFactory *self, const char *url);
 
+/**
+ * px_proxy_factory_get_proxies_async:
+ * @self: a #pxProxyFactory
+ * @url: Get proxies for specificed URL
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the lookup is done
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronous version of px_proxy_factory_get_proxies(). The lookup runs
+ * on an internal pool of worker threads and never blocks the calling
+ * thread, so it is safe to use from a main loop. A lookup which is no
+ * longer needed can be aborted through @cancellable, which also stops a
+ * PAC download in progress.
+ *
+ * @callback is invoked in the thread-default main context of the caller.
+ * Call px_proxy_factory_get_proxies_finish() from it to get the result.
+ * The source object passed to @callback is internal and must not be used.
+ *
+ * @since 0.5.13
+ */
+void px_proxy_factory_get_proxies_async (pxProxyFactory      *self,
+                                         const char          *url,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data);
+
+/**
+ * px_proxy_factory_get_proxies_finish:
+ * @self: a #pxProxyFactory
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError
+ *
+ * Finishes a lookup started with px_proxy_factory_get_proxies_async().
+ *
+ * To free the returned value, call @px_proxy_factory_free_proxies.
+ *
+ * Returns: (transfer full) (nullable): a list of proxies, or %NULL with
+ *   @error set to %G_IO_ERROR_CANCELLED if the lookup was cancelled.
+ *
+ * @since 0.5.13
+ */
+char **px_proxy_factory_get_proxies_finish (pxProxyFactory  *self,
+                                            GAsyncResult    *result,
+                                            GError         **error);
+
+/**
+ * px_proxy_factory_get_proxies_batch:
+ * @self: a #pxProxyFactory
+ * @urls: (array zero-terminated=1): a %NULL-terminated array of URLs
+ *
+ * Get which proxies to use for each of the specified @urls.
+ *
+ * The result is the same as calling px_proxy_factory_get_proxies() for
+ * every URL, but much cheaper for large sets of URLs: the configuration
+ * is only read once per distinct scheme, host and port, and all URLs are
+ * resolved against the same PAC.
+ *
+ * To free the returned value, call @px_proxy_factory_free_proxies_batch.
+ *
+ * Returns: (transfer full): a %NULL-terminated array holding one list of
+ *   proxies per URL, in the order of @urls
+ *
+ * @since 0.5.13
+ */
+char ***px_proxy_factory_get_proxies_batch (pxProxyFactory     *self,
+                                            const char * const *urls);
+
+/**
+ * px_proxy_factory_free_proxies_batch:
+ * @proxies: the array returned by @px_proxy_factory_get_proxies_batch
+ *
+ * Frees the result of @px_proxy_factory_get_proxies_batch.
+ *
+ * @since 0.5.13
+ */
+void px_proxy_factory_free_proxies_batch (char ***proxies);
+
 /**
  * px_proxy_factory_free_proxies
  * @proxies: (array zero-terminated=1): a %NULL-terminated array of proxies
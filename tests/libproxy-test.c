@@ -24,6 +24,7 @@
 #include <gio/gio.h>
 
 typedef struct {
+  GMainLoop *loop;
   pxProxyFactory *pf;
 } Fixture;
 
@@ -31,6 +32,7 @@ static void
 fixture_setup (Fixture       *self,
                gconstpointer  data)
 {
+  self->loop = g_main_loop_new (NULL, FALSE);
   self->pf = px_proxy_factory_new ();
 }
 
@@ -39,6 +41,7 @@ fixture_teardown (Fixture       *fixture,
                   gconstpointer  data)
 {
   px_proxy_factory_free (fixture->pf);
+  g_clear_pointer (&fixture->loop, g_main_loop_unref);
 }
 
 static void
@@ -62,6 +65,49 @@ test_libproxy_setup (Fixture    *self,
   /* px_proxy_factory_free_proxies (proxies); */
 }
 
+static void
+on_libproxy_async (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  Fixture *self = user_data;
+  g_autoptr (GError) error = NULL;
+  char **proxies = NULL;
+
+  proxies = px_proxy_factory_get_proxies_finish (self->pf, result, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (proxies);
+  g_assert_nonnull (proxies[0]);
+  px_proxy_factory_free_proxies (proxies);
+
+  g_main_loop_quit (self->loop);
+}
+
+static void
+test_libproxy_async (Fixture    *self,
+                     const void *user_data)
+{
+  px_proxy_factory_get_proxies_async (self->pf, "https://www.example.com", NULL, on_libproxy_async, self);
+  g_main_loop_run (self->loop);
+}
+
+static void
+test_libproxy_batch (Fixture    *self,
+                     const void *user_data)
+{
+  const char *urls[] = { "https://www.example.com", "http://www.example.org", NULL };
+  char ***proxies = NULL;
+
+  proxies = px_proxy_factory_get_proxies_batch (self->pf, urls);
+  g_assert_nonnull (proxies);
+  g_assert_nonnull (proxies[0]);
+  g_assert_nonnull (proxies[0][0]);
+  g_assert_nonnull (proxies[1]);
+  g_assert_nonnull (proxies[1][0]);
+  g_assert_null (proxies[2]);
+  px_proxy_factory_free_proxies_batch (proxies);
+}
+
 static void
 test_libproxy_dup (Fixture    *self,
                    const void *user_data)
@@ -86,6 +132,8 @@ main (int    argc,
   g_test_init (&argc, &argv, NULL);
 
   g_test_add ("/libproxy/setup", Fixture, NULL, fixture_setup, test_libproxy_setup, fixture_teardown);
+  g_test_add ("/libproxy/async", Fixture, NULL, fixture_setup, test_libproxy_async, fixture_teardown);
+  g_test_add ("/libproxy/batch", Fixture, NULL, fixture_setup, test_libproxy_batch, fixture_teardown);
   g_test_add ("/libproxy/dup", Fixture, NULL, fixture_setup, test_libproxy_dup, fixture_teardown);
   g_test_add ("/libproxy/illegal_free", Fixture, NULL, fixture_setup, test_libproxy_illegal_free, fixture_teardown);
 
@@ -0,0 +1,205 @@
+/* pacrunner-duktape-bench.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "pacrunner-duktape-natives.h"
+#include "pacrunner-duktape-table.h"
+#include "pacutils.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "duktape.h"
+
+/*
+ * Compares the time per call of the JavaScript PAC helpers with their
+ * native versions, and the time to set up a heap by compiling the helpers
+ * with loading them from bytecode. Also compares running a simple PAC with
+ * looking hosts up in its decision table, and checking a host against a
+ * list of domains in a loop with dnsDomainIsAny().
+ */
+
+#define ITERATIONS 100000
+#define HEAPS 200
+
+static const char *calls[] = {
+  "shExpMatch('http://www.example.com/path/index.html', '*example.com/*')",
+  "dnsDomainIs('www.example.com', '.example.com')",
+  "localHostOrDomainIs('www.example.com', 'www.example.com')",
+  "isInNet('192.168.1.12', '192.168.0.0', '255.255.0.0')",
+  "weekdayRange('MON', 'FRI')",
+  "dateRange('JAN', 'DEC')",
+  "timeRange(8, 0, 17, 30)",
+};
+
+static duk_context *
+create_heap (gboolean natives)
+{
+  duk_context *ctx = duk_create_heap_default ();
+
+  if (duk_peval_string_noresult (ctx, JAVASCRIPT_ROUTINES))
+    g_error ("Could not evaluate PAC helpers");
+
+  if (natives)
+    px_duktape_natives_register (ctx);
+
+  return ctx;
+}
+
+static const char *table_hosts[] = {
+  "intranet",
+  "www.cdn.example.com",
+  "mail.example.com",
+  "10.1.2.3",
+};
+
+static const char *table_pac =
+  "function FindProxyForURL(url, host) {\n"
+  "  if (isPlainHostName(host) || dnsDomainIs(host, '.intranet.example.com'))\n"
+  "    return 'DIRECT';\n"
+  "  if (shExpMatch(host, '*.cdn.example.com') || shExpMatch(host, 'build??.example.com'))\n"
+  "    return 'PROXY cdn:8080';\n"
+  "  if (dnsDomainIs(host, '.example.com') || isInNet(host, '10.0.0.0', '255.0.0.0'))\n"
+  "    return 'PROXY corp:3128; DIRECT';\n"
+  "  return 'PROXY default:3128';\n"
+  "}\n";
+
+static const char *list_setup =
+  "var domains = [];\n"
+  "for (var i = 0; i < 1000; i++)\n"
+  "  domains.push('.domain' + i + '.example.com');\n"
+  "function inDomains(host) {\n"
+  "  for (var i = 0; i < domains.length; i++)\n"
+  "    if (dnsDomainIs(host, domains[i]))\n"
+  "      return true;\n"
+  "  return false;\n"
+  "}\n";
+
+static const char *list_calls[][2] = {
+  { "inDomains('www.domain999.example.com')", "dnsDomainIsAny('www.domain999.example.com', domains)" },
+  { "inDomains('www.example.org')", "dnsDomainIsAny('www.example.org', domains)" },
+};
+
+/* Returns the time per call in nanoseconds */
+static double
+measure (duk_context *ctx,
+         const char  *call)
+{
+  g_autofree char *loop = g_strdup_printf ("(function () { for (var i = 0; i < %d; i++) %s; })()", ITERATIONS, call);
+  gint64 start;
+
+  start = g_get_monotonic_time ();
+  if (duk_peval_string_noresult (ctx, loop))
+    g_error ("Could not run %s", call);
+
+  return (g_get_monotonic_time () - start) * 1000.0 / ITERATIONS;
+}
+
+/* Returns the time per lookup in nanoseconds */
+static double
+measure_table (const char *host)
+{
+  PxPacTable *table = px_pac_table_compile (table_pac, strlen (table_pac));
+  gint64 start;
+
+  if (!table)
+    g_error ("Could not compile PAC");
+
+  start = g_get_monotonic_time ();
+  for (int idx = 0; idx < ITERATIONS; idx++) {
+    if (!px_pac_table_lookup (table, host))
+      g_error ("No result for %s", host);
+  }
+
+  px_pac_table_unref (table);
+
+  return (g_get_monotonic_time () - start) * 1000.0 / ITERATIONS;
+}
+
+/* Returns the time per heap in microseconds */
+static double
+measure_startup (gboolean precompiled)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  for (int idx = 0; idx < HEAPS; idx++) {
+    duk_context *ctx = duk_create_heap_default ();
+
+    if (precompiled) {
+      if (!px_duktape_routines_load (ctx))
+        g_error ("Could not load PAC helpers");
+    } else {
+      if (duk_peval_string_noresult (ctx, JAVASCRIPT_ROUTINES))
+        g_error ("Could not evaluate PAC helpers");
+      px_duktape_natives_register (ctx);
+    }
+
+    duk_destroy_heap (ctx);
+  }
+
+  return (g_get_monotonic_time () - start) / (double)HEAPS;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  duk_context *reference = create_heap (FALSE);
+  duk_context *native = create_heap (TRUE);
+  double compiled;
+  double loaded;
+
+  compiled = measure_startup (FALSE);
+  loaded = measure_startup (TRUE);
+  g_print ("%-60s %10.1f us %10.1f us %6.1fx\n", "heap setup", compiled, loaded, compiled / loaded);
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (calls); idx++) {
+    double js = measure (reference, calls[idx]);
+    double c = measure (native, calls[idx]);
+
+    g_print ("%-60s %10.1f ns %10.1f ns %6.1fx\n", calls[idx], js, c, js / c);
+  }
+
+  if (duk_peval_string_noresult (native, table_pac))
+    g_error ("Could not evaluate PAC");
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (table_hosts); idx++) {
+    g_autofree char *call = g_strdup_printf ("FindProxyForURL('https://%s/', '%s')", table_hosts[idx], table_hosts[idx]);
+    double pac = measure (native, call);
+    double table = measure_table (table_hosts[idx]);
+
+    g_print ("%-60s %10.1f ns %10.1f ns %6.1fx\n", call, pac, table, pac / table);
+  }
+
+  if (duk_peval_string_noresult (native, list_setup))
+    g_error ("Could not set up domain list");
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (list_calls); idx++) {
+    double loop = measure (native, list_calls[idx][0]);
+    double any = measure (native, list_calls[idx][1]);
+
+    g_print ("%-60s %10.1f ns %10.1f ns %6.1fx\n", list_calls[idx][0], loop, any, loop / any);
+  }
+
+  duk_destroy_heap (reference);
+  duk_destroy_heap (native);
+
+  return 0;
+}
@@ -0,0 +1,686 @@
+/* pacrunner-duktape-test.c
+ *
+ * Copyright 2023 The Libproxy Team
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "pacrunner-duktape.h"
+#include "pacrunner-duktape-analysis.h"
+#include "pacrunner-duktape-arena.h"
+#include "pacrunner-duktape-natives.h"
+#include "pacrunner-duktape-table.h"
+#include "pacutils.h"
+#include "px-plugin-pacrunner.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "duktape.h"
+
+/* Only "localhost" resolves, so isInNet() does not depend on the network */
+#define DNS_RESOLVE_STUB \
+  "function dnsResolve(host) { return host == 'localhost' ? '127.0.0.1' : null; }\n"
+
+typedef struct {
+  duk_context *reference;
+  duk_context *native;
+} Fixture;
+
+static duk_context *
+create_heap (gboolean natives)
+{
+  duk_context *ctx = duk_create_heap_default ();
+
+  g_assert_nonnull (ctx);
+  g_assert_cmpint (duk_peval_string_noresult (ctx, JAVASCRIPT_ROUTINES DNS_RESOLVE_STUB), ==, 0);
+
+  if (natives)
+    px_duktape_natives_register (ctx);
+
+  return ctx;
+}
+
+static void
+fixture_setup (Fixture       *fixture,
+               gconstpointer  user_data)
+{
+  fixture->reference = create_heap (FALSE);
+  fixture->native = create_heap (TRUE);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+                  gconstpointer  user_data)
+{
+  g_clear_pointer (&fixture->reference, duk_destroy_heap);
+  g_clear_pointer (&fixture->native, duk_destroy_heap);
+}
+
+static char *
+eval (duk_context *ctx,
+      const char  *expression)
+{
+  char *result;
+
+  if (duk_peval_string (ctx, expression) != 0)
+    result = g_strdup_printf ("error: %s", duk_safe_to_string (ctx, -1));
+  else
+    result = g_strdup (duk_safe_to_string (ctx, -1));
+
+  duk_pop (ctx);
+
+  return result;
+}
+
+static void
+assert_same (Fixture    *fixture,
+             const char *expression)
+{
+  g_autofree char *reference = eval (fixture->reference, expression);
+  g_autofree char *native = eval (fixture->native, expression);
+
+  /* Date based results may differ if a second boundary was crossed */
+  if (g_strcmp0 (reference, native) != 0) {
+    g_free (reference);
+    g_free (native);
+    reference = eval (fixture->reference, expression);
+    native = eval (fixture->native, expression);
+  }
+
+  g_test_message ("%s: %s", expression, native);
+  g_assert_cmpstr (native, ==, reference);
+}
+
+static void
+assert_native (Fixture    *fixture,
+               const char *expression,
+               const char *expected)
+{
+  g_autofree char *native = eval (fixture->native, expression);
+
+  g_assert_cmpstr (native, ==, expected);
+}
+
+static void
+test_sh_exp_match (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+  assert_same (fixture, "shExpMatch('http://home.netscape.com/people/ari/index.html', '*/ari/*')");
+  assert_same (fixture, "shExpMatch('http://home.netscape.com/people/montulli/index.html', '*/ari/*')");
+  assert_same (fixture, "shExpMatch('www.example.com', '*.example.com')");
+  assert_same (fixture, "shExpMatch('example.com', '*.example.com')");
+  assert_same (fixture, "shExpMatch('wwwXexample.com', 'www.example.com')");
+  assert_same (fixture, "shExpMatch('abc', 'a?c')");
+  assert_same (fixture, "shExpMatch('ac', 'a?c')");
+  assert_same (fixture, "shExpMatch('abcbc', '*bc')");
+  assert_same (fixture, "shExpMatch('aaa', '*a*a*a*')");
+  assert_same (fixture, "shExpMatch('aa', '*a*a*a*')");
+  assert_same (fixture, "shExpMatch('', '*')");
+  assert_same (fixture, "shExpMatch('', '')");
+  assert_same (fixture, "shExpMatch('abc', '')");
+
+  /* Regular expression syntax in the pattern is kept */
+  assert_same (fixture, "shExpMatch('a+b', 'a+b')");
+  assert_same (fixture, "shExpMatch('aab', 'a+b')");
+  assert_same (fixture, "shExpMatch('[a]', '[a]')");
+  assert_same (fixture, "shExpMatch('a', '[a]')");
+  assert_same (fixture, "shExpMatch('a', 'a|b')");
+  assert_same (fixture, "shExpMatch('a', '(')");
+
+  /* Wildcards do not match line terminators, and match UTF-16 code units */
+  assert_same (fixture, "shExpMatch('a\\nb', 'a*b')");
+  assert_same (fixture, "shExpMatch('a\\u2028b', 'a?b')");
+  assert_same (fixture, "shExpMatch('\\u00e9', '?')");
+  assert_same (fixture, "shExpMatch('\\ud83d\\ude00', '?')");
+  assert_same (fixture, "shExpMatch('\\ud83d\\ude00', '?" "?')");
+
+  /* Arguments are not converted the same way */
+  assert_same (fixture, "shExpMatch(1, '1')");
+  assert_same (fixture, "shExpMatch('1', 1)");
+}
+
+static void
+test_dns_domain_is (Fixture       *fixture,
+                    gconstpointer  user_data)
+{
+  assert_same (fixture, "dnsDomainIs('www.netscape.com', '.netscape.com')");
+  assert_same (fixture, "dnsDomainIs('www', '.netscape.com')");
+  assert_same (fixture, "dnsDomainIs('www.mcom.com', '.netscape.com')");
+  assert_same (fixture, "dnsDomainIs('netscape.com', 'netscape.com')");
+  assert_same (fixture, "dnsDomainIs('', '')");
+}
+
+static void
+test_local_host_or_domain_is (Fixture       *fixture,
+                              gconstpointer  user_data)
+{
+  assert_same (fixture, "localHostOrDomainIs('www.netscape.com', 'www.netscape.com')");
+  assert_same (fixture, "localHostOrDomainIs('www.mcom.com', 'www.netscape.com')");
+  assert_same (fixture, "localHostOrDomainIs('home.netscape.com', 'www.netscape.com')");
+
+  /* Plain host names become part of a regular expression which does not
+   * match, unless they contain regular expression syntax themselves */
+  assert_same (fixture, "localHostOrDomainIs('www', 'www.netscape.com')");
+  assert_same (fixture, "localHostOrDomainIs('www', 'www')");
+  assert_same (fixture, "localHostOrDomainIs('ww', 'www.netscape.com')");
+  assert_same (fixture, "localHostOrDomainIs('a|', 'www.netscape.com/')");
+  assert_same (fixture, "localHostOrDomainIs('(', 'www.netscape.com')");
+  assert_same (fixture, "localHostOrDomainIs(1, '1')");
+}
+
+static void
+test_convert_addr (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+  assert_same (fixture, "convert_addr('10.0.0.1')");
+  assert_same (fixture, "convert_addr('255.255.255.255')");
+  assert_same (fixture, "convert_addr('192.168.1.256')");
+  assert_same (fixture, "convert_addr('1.2.3')");
+  assert_same (fixture, "convert_addr('1.2.3.4.5')");
+  assert_same (fixture, "convert_addr('a.b.c.d')");
+  assert_same (fixture, "convert_addr(' 1. 0x10.-1.1e2')");
+  assert_same (fixture, "convert_addr('')");
+}
+
+static void
+test_is_in_net (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+  assert_same (fixture, "isInNet('198.95.249.79', '198.95.249.79', '255.255.255.255')");
+  assert_same (fixture, "isInNet('198.95.249.78', '198.95.249.79', '255.255.255.255')");
+  assert_same (fixture, "isInNet('198.95.6.8', '198.95.0.0', '255.255.0.0')");
+  assert_same (fixture, "isInNet('10.1.2.3', '192.168.0.0', '255.255.0.0')");
+  assert_same (fixture, "isInNet('10.1.2.3', '0.0.0.0', '0.0.0.0')");
+  assert_same (fixture, "isInNet('10.1.2.300', '10.0.0.0', '255.0.0.0')");
+  assert_same (fixture, "isInNet('localhost', '127.0.0.0', '255.0.0.0')");
+  assert_same (fixture, "isInNet('unresolvable', '127.0.0.0', '255.0.0.0')");
+  assert_same (fixture, "isInNet('1.2.3', '1.2.3.0', '255.255.255.0')");
+}
+
+static void
+test_weekday_range (Fixture       *fixture,
+                    gconstpointer  user_data)
+{
+  const char *days[] = { "SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT", "XXX" };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (days); idx++) {
+    g_autofree char *single = g_strdup_printf ("weekdayRange('%s')", days[idx]);
+    g_autofree char *gmt = g_strdup_printf ("weekdayRange('%s', 'GMT')", days[idx]);
+    g_autofree char *from = g_strdup_printf ("weekdayRange('%s', 'SAT')", days[idx]);
+    g_autofree char *to = g_strdup_printf ("weekdayRange('SUN', '%s', 'GMT')", days[idx]);
+
+    assert_same (fixture, single);
+    assert_same (fixture, gmt);
+    assert_same (fixture, from);
+    assert_same (fixture, to);
+  }
+
+  assert_same (fixture, "weekdayRange()");
+  assert_same (fixture, "weekdayRange('GMT')");
+  assert_same (fixture, "weekdayRange('SAT', 'SUN')");
+}
+
+static void
+test_date_range (Fixture       *fixture,
+                 gconstpointer  user_data)
+{
+  g_autoptr (GDateTime) now = g_date_time_new_now_local ();
+  const char *expressions[] = {
+    "dateRange()",
+    "dateRange('GMT')",
+    "dateRange('JAN')",
+    "dateRange('XXX')",
+    "dateRange(1)",
+    "dateRange(31, 'GMT')",
+    "dateRange(1995)",
+    "dateRange(1, 15)",
+    "dateRange(1, 31)",
+    "dateRange('JAN', 'JUN')",
+    "dateRange('JUL', 'DEC')",
+    "dateRange('JAN', 'DEC', 'GMT')",
+    "dateRange(1995, 2050)",
+    "dateRange(1, 'JAN', 'DEC')",
+    "dateRange(1, 'JAN', 31, 'DEC')",
+    "dateRange(1, 'JAN', 1995, 31, 'DEC', 2050)",
+    "dateRange('JAN', 1995, 'DEC', 2050)",
+    "dateRange(1, 'FEB', 30, 'FEB')",
+  };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (expressions); idx++)
+    assert_same (fixture, expressions[idx]);
+
+  for (int day = 1; day <= 31; day += 5) {
+    g_autofree char *expression = g_strdup_printf ("dateRange(%d, %d)", day, g_date_time_get_day_of_month (now));
+
+    assert_same (fixture, expression);
+  }
+}
+
+static void
+test_time_range (Fixture       *fixture,
+                 gconstpointer  user_data)
+{
+  g_autoptr (GDateTime) now = g_date_time_new_now_local ();
+  int hour = g_date_time_get_hour (now);
+  const char *expressions[] = {
+    "timeRange()",
+    "timeRange('GMT')",
+    "timeRange(0, 23)",
+    "timeRange(0, 23, 'GMT')",
+    "timeRange(0, 0, 23, 59)",
+    "timeRange(0, 0, 0, 23, 59, 59)",
+    "timeRange(0, 0, 0, 23, 59, 59, 'GMT')",
+    "timeRange('x', 23)",
+    "timeRange(1, 2, 3)",
+    "timeRange(1, 2, 3, 4, 5)",
+  };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (expressions); idx++)
+    assert_same (fixture, expressions[idx]);
+
+  for (int offset = -1; offset <= 1; offset++) {
+    g_autofree char *single = g_strdup_printf ("timeRange(%d)", hour + offset);
+    g_autofree char *range = g_strdup_printf ("timeRange(%d, 0, %d, 30)", hour + offset, hour + offset);
+
+    assert_same (fixture, single);
+    assert_same (fixture, range);
+  }
+}
+
+static void
+test_match_any (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+  const char *hosts[] = {
+    "www.example.com",
+    "example.com",
+    "www.example.org",
+    "myintranet",
+    "build42.example.net",
+    "build4.example.net",
+    "a.b.c",
+    "xyz",
+    "",
+  };
+
+  g_free (eval (fixture->native,
+                "var domains = ['.example.com', 'example.org', 'intranet'];\n"
+                "var patterns = ['*.example.com', 'intranet', 'build??.example.net', 'a.b.c', '*.b.*'];\n"
+                "function some(host, list, match) {\n"
+                "  return list.some(function (entry) { return match(host, entry); });\n"
+                "}\n"));
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (hosts); idx++) {
+    g_autofree char *domains = g_strdup_printf ("dnsDomainIsAny('%s', domains)", hosts[idx]);
+    g_autofree char *domains_loop = g_strdup_printf ("some('%s', domains, dnsDomainIs)", hosts[idx]);
+    g_autofree char *patterns = g_strdup_printf ("shExpMatchAny('%s', patterns)", hosts[idx]);
+    g_autofree char *patterns_loop = g_strdup_printf ("some('%s', patterns, shExpMatch)", hosts[idx]);
+    g_autofree char *expected = eval (fixture->native, domains_loop);
+
+    assert_native (fixture, domains, expected);
+    g_free (expected);
+    expected = eval (fixture->native, patterns_loop);
+    assert_native (fixture, patterns, expected);
+  }
+
+  /* The cached matchers are rebuilt when the lists grow */
+  assert_native (fixture, "dnsDomainIsAny('www.example.net', domains)", "false");
+  assert_native (fixture, "domains.push('.net'); dnsDomainIsAny('www.example.net', domains)", "true");
+  assert_native (fixture, "shExpMatchAny('proxy', patterns)", "false");
+  assert_native (fixture, "patterns.push('pr?x*'); shExpMatchAny('proxy', patterns)", "true");
+
+  /* Frozen lists just are not cached */
+  assert_native (fixture, "dnsDomainIsAny('www.example.com', Object.freeze(['.com']))", "true");
+  assert_native (fixture, "dnsDomainIsAny('www.example.com', '.com')", "false");
+  assert_native (fixture, "shExpMatchAny('www.example.com', [])", "false");
+}
+
+static void
+test_next_change (void)
+{
+  const char *time_ranges[][8] = {
+    { "12", NULL },
+    { "8", "17", NULL },
+    { "22", "3", "GMT", NULL },
+    { "8", "30", "17", "45", NULL },
+    { "8", "30", "15", "17", "45", "10", "GMT", NULL },
+    { "25", "70", "-1", "0", NULL },
+    { "x", "2", NULL },
+  };
+  const char *day_ranges[][4] = {
+    { "MON", "FRI", NULL },
+    { "SAT", "GMT", NULL },
+    { "1", "15", NULL },
+    { "JAN", "JUN", "GMT", NULL },
+  };
+  gint64 start = g_get_real_time ();
+
+  /* Results may only change at the boundaries, never between them */
+  for (gint64 now = start; now < start + 2 * G_TIME_SPAN_DAY; now += 7 * G_TIME_SPAN_MINUTE + 1234) {
+    for (guint idx = 0; idx < G_N_ELEMENTS (time_ranges); idx++) {
+      const char * const *argv = time_ranges[idx];
+      int argc = g_strv_length ((char **)argv);
+      gint64 next = px_pac_time_range_next_change (argv, argc, now);
+      gboolean at_now;
+      gboolean before_next;
+
+      g_assert_cmpint (next, >, now);
+      g_assert_true (px_pac_time_range (argv, argc, now, &at_now));
+      g_assert_true (px_pac_time_range (argv, argc, next - 1000, &before_next));
+      g_assert_cmpint (at_now, ==, before_next);
+    }
+
+    for (guint idx = 0; idx < G_N_ELEMENTS (day_ranges); idx++) {
+      const char * const *argv = day_ranges[idx];
+      int argc = g_strv_length ((char **)argv);
+      gint64 next = px_pac_day_range_next_change (now);
+
+      g_assert_cmpint (next, >, now);
+      g_assert_cmpint (px_pac_weekday_range (argv, argc, now), ==, px_pac_weekday_range (argv, argc, next - 1000));
+      g_assert_cmpint (px_pac_date_range (argv, argc, now), ==, px_pac_date_range (argv, argc, next - 1000));
+    }
+  }
+}
+
+#define TABLE_PAC \
+  "function FindProxyForURL(url, host) {\n" \
+  "  if (isPlainHostName(host) || dnsDomainIs(host, '.intranet.example.com'))\n" \
+  "    return 'DIRECT';\n" \
+  "  if (shExpMatch(host, '*.cdn.example.com') || shExpMatch(host, 'build??.example.com'))\n" \
+  "    return 'PROXY cdn:8080';\n" \
+  "  else if (isInNet(host, '10.0.0.0', '255.0.0.0') || (shExpMatch(host, 'git.example.com')))\n" \
+  "    return 'DIRECT';\n" \
+  "  if (dnsDomainIs(host, 'example.com')) {\n" \
+  "    return 'PROXY corp:3128; DIRECT';\n" \
+  "  }\n" \
+  "  return 'PROXY default:3128';\n" \
+  "}\n"
+
+static void
+test_table_lookup (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+  g_autoptr (PxPacTable) table = px_pac_table_compile (TABLE_PAC, strlen (TABLE_PAC));
+  struct {
+    const char *host;
+    gboolean decided;
+  } tests[] = {
+    { "intranet", TRUE },
+    { "a.intranet.example.com", TRUE },
+    { "x.cdn.example.com", TRUE },
+    { "build42.example.com", TRUE },
+    { "10.1.2.3", TRUE },
+    { "10.1.2.300", TRUE },
+    { "11.1.2.3", TRUE },
+    { "git.example.com", TRUE },
+    /* The isInNet() before the match would have to resolve them */
+    { "build4.example.com", FALSE },
+    { "www.example.com", FALSE },
+    { "other.org", FALSE },
+  };
+
+  g_assert_nonnull (table);
+  g_assert_cmpuint (px_pac_table_get_n_rules (table), ==, 4);
+
+  /* Defines FindProxyForURL() in the heap to compare with */
+  g_free (eval (fixture->native, TABLE_PAC));
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (tests); idx++) {
+    g_autofree char *call = g_strdup_printf ("FindProxyForURL('http://%s/', '%s')", tests[idx].host, tests[idx].host);
+    g_autofree char *expected = eval (fixture->native, call);
+    const char *result = px_pac_table_lookup (table, tests[idx].host);
+
+    if (tests[idx].decided)
+      g_assert_cmpstr (result, ==, expected);
+    else
+      g_assert_null (result);
+  }
+  /* shExpMatch() wildcards do not match line terminators */
+  g_assert_null (px_pac_table_lookup (table, "x\n.cdn.example.com"));
+}
+
+static void
+test_table_unsupported (void)
+{
+  const char *pacs[] = {
+    "function FindProxyForURL(url, host) { if (shExpMatch(url, 'a')) return 'A'; }",
+    "function FindProxyForURL(url, host) { if (dnsDomainIs(host, 'a') && isPlainHostName(host)) return 'A'; }",
+    "var x = 1;\nfunction FindProxyForURL(url, host) { return 'A'; }",
+    "function FindProxyForURL(url, host) { return 'A'; }\nfunction dnsDomainIs(host, domain) { return true; }",
+    "function FindProxyForURL(url, host) { return 'A'; return 'B'; }",
+    "function FindProxyForURL(url, host) { if (dnsDomainIs(host, 'a\\\\b')) return 'A'; }",
+    "function FindProxyForURL(url, host) { if (dnsDomainIs(host, 'a')) return 'A' + 'B'; }",
+    "function FindProxyForURL(url, host) { if (isInNet(dnsResolve(host), '10.0.0.0', '255.0.0.0')) return 'A'; }",
+    "function FindProxyForURL(url, host) { if (shExpMatch(host, 'a+b')) return 'A'; }",
+  };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (pacs); idx++) {
+    g_autoptr (PxPacTable) table = px_pac_table_compile (pacs[idx], strlen (pacs[idx]));
+
+    g_test_message ("%s", pacs[idx]);
+    g_assert_null (table);
+  }
+}
+
+static void
+test_arena_shrink (void)
+{
+  PxDuktapeArena *arena = px_duktape_arena_new (8192);
+  char *large = px_duktape_arena_alloc (arena, 4096);
+  char *small = px_duktape_arena_alloc (arena, 256);
+  char *filler;
+  char *shrunk;
+
+  g_assert_nonnull (large);
+  g_assert_nonnull (small);
+  memset (large, 'x', 4096);
+  memset (small, 'y', 256);
+
+  /* Fill the arena up to its limit */
+  filler = px_duktape_arena_alloc (arena, 8192 - px_duktape_arena_get_used (arena) - 64);
+  g_assert_nonnull (filler);
+  g_assert_null (px_duktape_arena_realloc (arena, small, 512));
+
+  /* Shrinking still works, in place or by keeping the block */
+  shrunk = px_duktape_arena_realloc (arena, large, 1024);
+  g_assert_nonnull (shrunk);
+  g_assert_cmpint (shrunk[1023], ==, 'x');
+  g_assert_cmpuint (px_duktape_arena_get_size (arena, shrunk), ==, 1024);
+
+  small = px_duktape_arena_realloc (arena, small, 20);
+  g_assert_nonnull (small);
+  g_assert_cmpint (small[19], ==, 'y');
+
+  /* Like duktape, release everything before freeing the arena */
+  px_duktape_arena_release (arena, shrunk);
+  px_duktape_arena_release (arena, small);
+  px_duktape_arena_release (arena, filler);
+  g_assert_cmpuint (px_duktape_arena_get_used (arena), ==, 0);
+  px_duktape_arena_free (arena);
+}
+
+static void
+test_analyze (void)
+{
+  struct {
+    const char *pac;
+    PxPacDependencies dependencies;
+  } tests[] = {
+    { "function FindProxyForURL(url, host) { return 'DIRECT'; }", 0 },
+    { "function FindProxyForURL(url, host) {\n"
+      "  // url is not used\n"
+      "  var re = /url'/;\n"
+      "  for (var i = 0; i < 2; i++) host = host.toLowerCase();\n"
+      "  return re.test(host) || shExpMatch(host, '*.example.com') ? 'PROXY a:1' : 'DIRECT';\n"
+      "}", 0 },
+    { "function FindProxyForURL(url, host) { return url.substring(0, 5) == 'http:' ? 'PROXY a:1' : 'DIRECT'; }", PX_PAC_DEPENDS_URL },
+    { "function FindProxyForURL(url, host) { return timeRange(8, 18) ? 'PROXY a:1' : 'DIRECT'; }", PX_PAC_DEPENDS_TIME },
+    { "function FindProxyForURL(url, host) { return new Date().getHours() < 12 ? 'PROXY a:1' : 'DIRECT'; }", PX_PAC_DEPENDS_CLOCK },
+    { "function FindProxyForURL(url, host) { return isInNet(host, '10.0.0.0', '255.0.0.0') ? 'DIRECT' : 'PROXY a:1'; }", PX_PAC_DEPENDS_DNS },
+    { "function FindProxyForURL(url, host) { return myIpAddress() == '10.0.0.1' ? 'DIRECT' : 'PROXY a:1'; }", PX_PAC_DEPENDS_DNS },
+    { "var n = 0;\nfunction FindProxyForURL(url, host) { n++; return 'PROXY p' + (n % 2) + ':1'; }", PX_PAC_DEPENDS_STATE },
+    { "function FindProxyForURL(url, host) { calls = 1; return 'DIRECT'; }", PX_PAC_DEPENDS_STATE },
+    { "function FindProxyForURL(url, host) { return Math.random() < 0.5 ? 'PROXY a:1' : 'PROXY b:1'; }", PX_PAC_DEPENDS_STATE },
+    { "var state = { n: 0 };\nfunction FindProxyForURL(url, host) { state.n++; return 'PROXY p' + (state.n % 2) + ':1'; }", PX_PAC_DEPENDS_STATE },
+    { "var state = {};\nfunction FindProxyForURL(url, host) { state.n = (state.n || 0) + 1; return 'PROXY p' + (state.n % 2) + ':1'; }", PX_PAC_DEPENDS_STATE },
+    { "var hits = {};\nfunction FindProxyForURL(url, host) { return ++hits[host] > 10 ? 'DIRECT' : 'PROXY a:1'; }", PX_PAC_DEPENDS_STATE },
+    { "var cache = {};\nfunction FindProxyForURL(url, host) { if (!cache[host]) cache[host] = 'PROXY a:1'; return cache[host]; }", PX_PAC_DEPENDS_STATE },
+    { "var seen = [];\nfunction FindProxyForURL(url, host) { seen.push(host); return seen.length > 10 ? 'DIRECT' : 'PROXY a:1'; }", PX_PAC_DEPENDS_STATE },
+    { "var seen = {};\nfunction FindProxyForURL(url, host) { Object.defineProperty(seen, host, { value: 1 }); return 'DIRECT'; }", PX_PAC_DEPENDS_STATE },
+    { "var seen = { h: {} };\nfunction FindProxyForURL(url, host) { delete seen.h[host]; return 'DIRECT'; }", PX_PAC_DEPENDS_STATE },
+    /* Modifying objects local to the call is fine */
+    { "function FindProxyForURL(url, host) { var parts = host.split('.'); parts.reverse(); return parts[0] == 'com' ? 'DIRECT' : 'PROXY a:1'; }", 0 },
+    { "function FindProxyForURL(url, host) { return arguments[0]; }", PX_PAC_DEPENDS_ALL },
+    { "function FindProxyForURL(url, host) { return eval('url'); }", PX_PAC_DEPENDS_ALL },
+    { "var FindProxyForURL = function (url, host) { return 'DIRECT'; }", PX_PAC_DEPENDS_ALL },
+    { "function FindProxyForURL(url, host) { return 'DIRECT; }", PX_PAC_DEPENDS_ALL },
+  };
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (tests); idx++) {
+    g_test_message ("%s", tests[idx].pac);
+    g_assert_cmphex (px_pac_analyze (tests[idx].pac, strlen (tests[idx].pac)), ==, tests[idx].dependencies);
+  }
+}
+
+static void
+test_reload (void)
+{
+  g_autoptr (PxPacRunnerDuktape) runner = g_object_new (PX_PACRUNNER_TYPE_DUKTAPE, NULL);
+  PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (runner);
+  g_autoptr (GUri) uri = g_uri_parse ("http://www.example.com", G_URI_FLAGS_NONE, NULL);
+  g_autofree char *proxy = NULL;
+  guint64 baseline = 0;
+  guint64 used = 0;
+
+  /* Each PAC leaves a global behind, which must not outlive the next reload */
+  for (guint idx = 0; idx < 10000; idx++) {
+    char *pac = g_strdup_printf ("var data%u = new Array(1024).join('x');\n"
+                                 "function FindProxyForURL(url, host) { return 'PROXY proxy%u.example.com:8080'; }\n",
+                                 idx, idx);
+    g_autoptr (GBytes) pac_data = g_bytes_new_take (pac, strlen (pac));
+
+    g_assert_true (ifc->set_pac (PX_PAC_RUNNER (runner), pac_data));
+
+    if (idx == 100)
+      g_object_get (runner, "memory-used", &baseline, NULL);
+  }
+
+  g_object_get (runner, "memory-used", &used, NULL);
+  g_assert_cmpuint (baseline, >, 0);
+  g_assert_cmpuint (used, <=, baseline + baseline / 4);
+
+  proxy = ifc->run (PX_PAC_RUNNER (runner), uri);
+  g_assert_cmpstr (proxy, ==, "PROXY proxy9999.example.com:8080");
+}
+
+static void
+test_run_batch (void)
+{
+  g_autoptr (PxPacRunnerDuktape) runner = g_object_new (PX_PACRUNNER_TYPE_DUKTAPE, NULL);
+  PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (runner);
+  const char *pac = "function FindProxyForURL(url, host) {\n"
+                    "  if (host == 'throw.example.com') throw 'error';\n"
+                    "  return 'PROXY ' + host + ':8080';\n"
+                    "}\n";
+  g_autoptr (GBytes) pac_data = g_bytes_new_static (pac, strlen (pac));
+  const char *urls[] = {
+    "http://www.example.com",
+    "https://throw.example.com/path",
+    "ftp://ftp.example.org",
+  };
+  g_autoptr (GPtrArray) uris = g_ptr_array_new_with_free_func ((GDestroyNotify)g_uri_unref);
+  g_autoptr (GPtrArray) responses = NULL;
+
+  g_assert_true (ifc->set_pac (PX_PAC_RUNNER (runner), pac_data));
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (urls); idx++)
+    g_ptr_array_add (uris, g_uri_parse (urls[idx], G_URI_FLAGS_NONE, NULL));
+
+  responses = ifc->run_batch (PX_PAC_RUNNER (runner), uris);
+  g_assert_cmpuint (responses->len, ==, uris->len);
+
+  /* Responses match single evaluations, in order */
+  for (guint idx = 0; idx < uris->len; idx++) {
+    g_autofree char *proxy = ifc->run (PX_PAC_RUNNER (runner), g_ptr_array_index (uris, idx));
+
+    g_assert_cmpstr (g_ptr_array_index (responses, idx), ==, proxy);
+  }
+
+  g_assert_cmpstr (g_ptr_array_index (responses, 0), ==, "PROXY www.example.com:8080");
+  g_assert_cmpstr (g_ptr_array_index (responses, 1), ==, "");
+}
+
+static void
+test_run_batch_memory_limit (void)
+{
+  g_autoptr (PxPacRunnerDuktape) runner = g_object_new (PX_PACRUNNER_TYPE_DUKTAPE, "pool-size", 1, "memory-limit", (guint64)1024 * 1024, NULL);
+  PxPacRunnerInterface *ifc = PX_PAC_RUNNER_GET_IFACE (runner);
+  const char *pac = "function FindProxyForURL(url, host) {\n"
+                    "  var list = [];\n"
+                    "  if (host == 'big.example.com')\n"
+                    "    for (;;) list.push(new Array(1024).join(host));\n"
+                    "  return 'PROXY ' + host + ':8080';\n"
+                    "}\n";
+  g_autoptr (GBytes) pac_data = g_bytes_new_static (pac, strlen (pac));
+  const char *urls[] = {
+    "http://www.example.com",
+    "http://big.example.com",
+    "http://www.example.org",
+  };
+  g_autoptr (GPtrArray) uris = g_ptr_array_new_with_free_func ((GDestroyNotify)g_uri_unref);
+  g_autoptr (GPtrArray) responses = NULL;
+
+  g_assert_true (ifc->set_pac (PX_PAC_RUNNER (runner), pac_data));
+
+  for (guint idx = 0; idx < G_N_ELEMENTS (urls); idx++)
+    g_ptr_array_add (uris, g_uri_parse (urls[idx], G_URI_FLAGS_NONE, NULL));
+
+  /* Urls after the one running out of memory get a fresh heap */
+  responses = ifc->run_batch (PX_PAC_RUNNER (runner), uris);
+  g_assert_cmpuint (responses->len, ==, uris->len);
+  g_assert_cmpstr (g_ptr_array_index (responses, 0), ==, "PROXY www.example.com:8080");
+  g_assert_cmpstr (g_ptr_array_index (responses, 1), ==, "");
+  g_assert_cmpstr (g_ptr_array_index (responses, 2), ==, "PROXY www.example.org:8080");
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/natives/sh_exp_match", Fixture, NULL, fixture_setup, test_sh_exp_match, fixture_teardown);
+  g_test_add ("/natives/dns_domain_is", Fixture, NULL, fixture_setup, test_dns_domain_is, fixture_teardown);
+  g_test_add ("/natives/local_host_or_domain_is", Fixture, NULL, fixture_setup, test_local_host_or_domain_is, fixture_teardown);
+  g_test_add ("/natives/convert_addr", Fixture, NULL, fixture_setup, test_convert_addr, fixture_teardown);
+  g_test_add ("/natives/is_in_net", Fixture, NULL, fixture_setup, test_is_in_net, fixture_teardown);
+  g_test_add ("/natives/weekday_range", Fixture, NULL, fixture_setup, test_weekday_range, fixture_teardown);
+  g_test_add ("/natives/date_range", Fixture, NULL, fixture_setup, test_date_range, fixture_teardown);
+  g_test_add ("/natives/time_range", Fixture, NULL, fixture_setup, test_time_range, fixture_teardown);
+  g_test_add ("/natives/match_any", Fixture, NULL, fixture_setup, test_match_any, fixture_teardown);
+  g_test_add_func ("/natives/next_change", test_next_change);
+  g_test_add_func ("/arena/shrink", test_arena_shrink);
+  g_test_add_func ("/analysis/dependencies", test_analyze);
+  g_test_add ("/table/lookup", Fixture, NULL, fixture_setup, test_table_lookup, fixture_teardown);
+  g_test_add_func ("/table/unsupported", test_table_unsupported);
+  g_test_add_func ("/runner/reload", test_reload);
+  g_test_add_func ("/runner/run_batch", test_run_batch);
+  g_test_add_func ("/runner/run_batch_memory_limit", test_run_batch_memory_limit);
+
+  return g_test_run ();
+}
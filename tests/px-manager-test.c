@@ -23,8 +23,10 @@
 #include "px-manager-helper.h"
 
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #define SERVER_PORT 1983
+#define SERVER_ETAG "\"px-manager-test\""
 
 typedef struct {
   GMainLoop *loop;
@@ -64,8 +66,11 @@ on_incoming (GSocketService    *service,
   g_autofree char *line = NULL;
   g_autofree char *unescaped = NULL;
   g_autofree char *path = NULL;
+  g_autofree char *if_none_match = NULL;
+  gboolean revalidate;
   char *escaped;
   char *version;
+  char *query;
   char *tmp;
 
   in = g_io_stream_get_input_stream (G_IO_STREAM (connection));
@@ -103,6 +108,30 @@ on_incoming (GSocketService    *service,
     goto out;
   }
 
+  /* Read request headers up to the empty line */
+  while (TRUE) {
+    g_autofree char *header = g_data_input_stream_read_line (data, NULL, NULL, NULL);
+
+    if (!header || !*header)
+      break;
+
+    if (g_ascii_strncasecmp (header, "If-None-Match:", 14) == 0)
+      if_none_match = g_strstrip (g_strdup (header + 14));
+  }
+
+  /* "?revalidate" makes clients revalidate the file on every use */
+  query = strchr (escaped, '?');
+  if (query)
+    *query++ = 0;
+  revalidate = g_strcmp0 (query, "revalidate") == 0;
+
+  if (revalidate && g_strcmp0 (if_none_match, SERVER_ETAG) == 0) {
+    const char *not_modified = "HTTP/1.0 304 Not Modified\r\nETag: " SERVER_ETAG "\r\n\r\n";
+
+    g_output_stream_write_all (out, not_modified, strlen (not_modified), NULL, NULL, NULL);
+    goto out;
+  }
+
   unescaped = g_uri_unescape_string (escaped, NULL);
   path = g_test_build_filename (G_TEST_DIST, "data", unescaped, NULL);
   f = g_file_new_for_path (path);
@@ -116,6 +145,9 @@ on_incoming (GSocketService    *service,
 
   s = g_string_new ("HTTP/1.0 200 OK\r\n");
 
+  if (revalidate)
+    g_string_append (s, "ETag: " SERVER_ETAG "\r\nCache-Control: no-cache\r\n");
+
   info = g_file_input_stream_query_info (file_in,
 					 G_FILE_ATTRIBUTE_STANDARD_SIZE ","
 					 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
@@ -300,6 +332,237 @@ test_get_proxies_pac_debug (Fixture    *self,
   g_unsetenv ("PX_DEBUG");
 }
 
+static guint
+get_stat_uint (Fixture    *self,
+               const char *name)
+{
+  g_autoptr (GVariant) stats = g_variant_ref_sink (px_manager_get_stats (self->manager));
+  guint value = 0;
+
+  g_assert_true (g_variant_lookup (stats, name, "u", &value));
+
+  return value;
+}
+
+static gpointer
+get_proxies_cached (gpointer data)
+{
+  Fixture *self = data;
+  g_autofree char *dir = g_dir_make_tmp ("px-manager-XXXXXX", NULL);
+  g_autofree char *path = g_build_filename (dir, "proxy", NULL);
+  g_autofree char *sample = g_test_build_filename (G_TEST_DIST, "data", "px-manager-pac", NULL);
+  g_autofree char *contents = NULL;
+  g_auto (GStrv) config = NULL;
+  g_auto (GStrv) cached = NULL;
+
+  /* Work on a copy of the configuration, so that it can be changed */
+  g_assert_true (g_file_get_contents (sample, &contents, NULL, NULL));
+  g_assert_true (g_file_set_contents (path, contents, -1, NULL));
+  g_clear_object (&self->manager);
+  self->manager = px_test_manager_new ("config-sysconfig", path);
+
+  config = px_manager_get_proxies_sync (self->manager, "https://www.example.com");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+  g_assert_cmpstr (config[1], ==, "direct://");
+  g_assert_cmpuint (get_stat_uint (self, "cache-hits"), ==, 0);
+  g_assert_cmpuint (get_stat_uint (self, "cache-misses"), ==, 1);
+
+  /* Same host in a different case and with a fragment shares the cache entry */
+  cached = px_manager_get_proxies_sync (self->manager, "https://WWW.example.com#fragment");
+  g_assert_nonnull (cached);
+  g_assert_true (g_strv_equal ((const char * const *)config, (const char * const *)cached));
+  g_assert_cmpuint (get_stat_uint (self, "cache-hits"), ==, 1);
+  g_assert_cmpuint (get_stat_uint (self, "cache-misses"), ==, 1);
+  g_clear_pointer (&cached, g_strfreev);
+
+  /* A different path is a different entry, but resolves the same way */
+  cached = px_manager_get_proxies_sync (self->manager, "https://www.example.com/path?query");
+  g_assert_nonnull (cached);
+  g_assert_true (g_strv_equal ((const char * const *)config, (const char * const *)cached));
+  g_assert_cmpuint (get_stat_uint (self, "cache-hits"), ==, 1);
+  g_assert_cmpuint (get_stat_uint (self, "cache-misses"), ==, 2);
+  g_clear_pointer (&cached, g_strfreev);
+
+  /* A configuration change drops the cached result */
+  g_assert_true (g_file_set_contents (path, "PROXY_ENABLED=\"yes\"\nHTTPS_PROXY=\"http://127.0.0.1:1985\"\n", -1, NULL));
+  for (int idx = 0; idx < 500; idx++) {
+    cached = px_manager_get_proxies_sync (self->manager, "https://www.example.com");
+    if (g_strcmp0 (cached[0], "http://127.0.0.1:1985") == 0)
+      break;
+
+    g_clear_pointer (&cached, g_strfreev);
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+  }
+  g_assert_nonnull (cached);
+  g_assert_cmpstr (cached[0], ==, "http://127.0.0.1:1985");
+
+  g_unlink (path);
+  g_rmdir (dir);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_cached (Fixture    *self,
+                         const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_cached, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_concurrent_worker (gpointer data)
+{
+  Fixture *self = data;
+
+  for (int idx = 0; idx < 100; idx++) {
+    g_autofree char *url = g_strdup_printf ("https://www.example.com/%d", idx);
+    g_auto (GStrv) config = NULL;
+
+    config = px_manager_get_proxies_sync (self->manager, url);
+    g_assert_nonnull (config);
+    g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+    g_assert_cmpstr (config[1], ==, "direct://");
+  }
+
+  return NULL;
+}
+
+static gpointer
+get_proxies_concurrent (gpointer data)
+{
+  Fixture *self = data;
+  GThread *threads[8];
+
+  /* All threads race for the first PAC download */
+  for (int idx = 0; idx < G_N_ELEMENTS (threads); idx++)
+    threads[idx] = g_thread_new ("lookup", get_proxies_concurrent_worker, self);
+
+  for (int idx = 0; idx < G_N_ELEMENTS (threads); idx++)
+    g_thread_join (threads[idx]);
+
+  /* And share a single one */
+  g_assert_cmpuint (get_stat_uint (self, "pac-downloads"), ==, 1);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_concurrent (Fixture    *self,
+                             const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_concurrent, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_batch (gpointer data)
+{
+  Fixture *self = data;
+  const char *urls[] = {
+    "https://www.example.com",
+    "https://192.168.10.4",
+    "invalid",
+    "https://www.example.com/path",
+    NULL
+  };
+  char ***batch;
+
+  batch = px_manager_get_proxies_batch_sync (self->manager, urls);
+  g_assert_nonnull (batch);
+
+  /* Results match single lookups, in order */
+  for (int idx = 0; urls[idx]; idx++) {
+    g_auto (GStrv) config = px_manager_get_proxies_sync (self->manager, urls[idx]);
+
+    g_assert_nonnull (batch[idx]);
+    g_assert_true (g_strv_equal ((const char * const *)config, (const char * const *)batch[idx]));
+  }
+  g_assert_null (batch[G_N_ELEMENTS (urls) - 1]);
+
+  g_assert_cmpstr (batch[0][0], ==, "http://127.0.0.1:1984");
+  g_assert_cmpstr (batch[1][0], ==, "socks://127.0.0.1:1983");
+  g_assert_cmpstr (batch[2][0], ==, "direct://");
+
+  px_manager_free_proxies_batch (batch);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_batch (Fixture    *self,
+                        const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_batch, self);
+  g_main_loop_run (self->loop);
+}
+
+static void
+on_get_proxies_async (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  Fixture *self = user_data;
+  g_auto (GStrv) config = NULL;
+  g_autoptr (GError) error = NULL;
+
+  config = px_manager_get_proxies_finish (PX_MANAGER (source_object), result, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+  g_assert_cmpstr (config[1], ==, "direct://");
+
+  g_main_loop_quit (self->loop);
+}
+
+static void
+test_get_proxies_async (Fixture    *self,
+                        const void *user_data)
+{
+  px_manager_get_proxies_async (self->manager, "https://www.example.com", NULL, on_get_proxies_async, self);
+  g_main_loop_run (self->loop);
+}
+
+static void
+on_get_proxies_async_cancelled (GObject      *source_object,
+                                GAsyncResult *result,
+                                gpointer      user_data)
+{
+  Fixture *self = user_data;
+  g_auto (GStrv) config = NULL;
+  g_autoptr (GError) error = NULL;
+
+  config = px_manager_get_proxies_finish (PX_MANAGER (source_object), result, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (config);
+
+  g_main_loop_quit (self->loop);
+}
+
+static void
+test_get_proxies_async_cancelled (Fixture    *self,
+                                  const void *user_data)
+{
+  g_autoptr (GCancellable) cancellable = g_cancellable_new ();
+
+  g_cancellable_cancel (cancellable);
+  px_manager_get_proxies_async (self->manager, "https://www.example.com", cancellable, on_get_proxies_async_cancelled, self);
+  g_main_loop_run (self->loop);
+}
+
 static gpointer
 get_wpad (gpointer data)
 {
@@ -325,6 +588,331 @@ test_get_wpad (Fixture    *self,
   g_main_loop_run (self->loop);
 }
 
+static guint
+get_pac_failures (Fixture    *self,
+                  const char *pac_url)
+{
+  g_autoptr (GVariant) stats = g_variant_ref_sink (px_manager_get_stats (self->manager));
+  g_autoptr (GVariant) backoff = g_variant_lookup_value (stats, "pac-backoff", G_VARIANT_TYPE ("a{s(ux)}"));
+  guint failures = 0;
+  gint64 retry_in;
+
+  g_assert_nonnull (backoff);
+  if (!g_variant_lookup (backoff, pac_url, "(ux)", &failures, &retry_in))
+    return 0;
+
+  return failures;
+}
+
+static gpointer
+get_wpad_backoff (gpointer data)
+{
+  Fixture *self = data;
+  g_auto (GStrv) config = NULL;
+
+  g_assert_cmpuint (get_pac_failures (self, "http://wpad/wpad.dat"), ==, 0);
+
+  config = px_manager_get_proxies_sync (self->manager, "https://www.example.com");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+  g_assert_cmpuint (get_pac_failures (self, "http://wpad/wpad.dat"), ==, 1);
+  g_clear_pointer (&config, g_strfreev);
+
+  /* A different url is not cached, but must not retry the download yet */
+  config = px_manager_get_proxies_sync (self->manager, "https://www.example.org");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+  g_assert_cmpuint (get_pac_failures (self, "http://wpad/wpad.dat"), ==, 1);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_wpad_backoff (Fixture    *self,
+                       const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_wpad_backoff, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_revalidate (gpointer data)
+{
+  Fixture *self = data;
+
+  for (int idx = 0; idx < 3; idx++) {
+    g_autofree char *url = g_strdup_printf ("https://www.example.com/%d", idx);
+    g_auto (GStrv) config = NULL;
+
+    config = px_manager_get_proxies_sync (self->manager, url);
+    g_assert_nonnull (config);
+    g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+  }
+
+  /* Downloaded once, then revalidated in the background */
+  for (int idx = 0; idx < 500 && get_stat_uint (self, "pac-not-modified") == 0; idx++)
+    g_usleep (10 * G_TIME_SPAN_MILLISECOND);
+
+  g_assert_cmpuint (get_stat_uint (self, "pac-downloads"), ==, 1);
+  g_assert_cmpuint (get_stat_uint (self, "pac-not-modified"), >=, 1);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_revalidate (Fixture    *self,
+                             const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_revalidate, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_slots (gpointer data)
+{
+  Fixture *self = data;
+  g_autoptr (GVariant) stats = NULL;
+  g_autofree const char **slots = NULL;
+
+  /* Alternating between PAC files must not download them again */
+  for (int idx = 0; idx < 6; idx++) {
+    g_autofree char *url = g_strdup_printf ("%s://www.example.com/%d", idx % 2 ? "https" : "http", idx);
+    g_auto (GStrv) config = NULL;
+
+    config = px_manager_get_proxies_sync (self->manager, url);
+    g_assert_nonnull (config);
+    g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+  }
+
+  g_assert_cmpuint (get_stat_uint (self, "pac-downloads"), ==, 2);
+  /* Both urls serve the same PAC, so it is only compiled once */
+  g_assert_cmpuint (get_stat_uint (self, "pac-compiles-skipped"), ==, 1);
+
+  stats = g_variant_ref_sink (px_manager_get_stats (self->manager));
+  g_assert_true (g_variant_lookup (stats, "pac-slots", "^a&s", &slots));
+  g_assert_cmpuint (g_strv_length ((char **)slots), ==, 2);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_slots (Fixture    *self,
+                        const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_slots, self);
+  g_main_loop_run (self->loop);
+}
+
+static PxManager *
+disk_cache_manager_new (void)
+{
+  g_autofree char *path = g_test_build_filename (G_TEST_DIST, "data", "px-manager-pac-revalidate", NULL);
+
+  return px_manager_new_with_options ("config-plugin", "config-sysconfig",
+                                      "config-option", path,
+                                      "force-online", TRUE,
+                                      "disk-cache", TRUE,
+                                      NULL);
+}
+
+static gpointer
+get_proxies_disk_cache (gpointer data)
+{
+  Fixture *self = data;
+  g_autoptr (PxManager) manager = NULL;
+  g_auto (GStrv) config = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_autoptr (GDir) dir = NULL;
+  g_autofree char *cache_dir = g_build_filename (g_get_user_cache_dir (), "libproxy", NULL);
+  const char *name;
+  guint bytecode_files = 0;
+  guint downloads = 0;
+
+  manager = disk_cache_manager_new ();
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com");
+  g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+  g_clear_pointer (&config, g_strfreev);
+  g_clear_object (&manager);
+
+  /* A new manager starts with the PAC from disk */
+  manager = disk_cache_manager_new ();
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com");
+  g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+
+  stats = g_variant_ref_sink (px_manager_get_stats (manager));
+  g_assert_true (g_variant_lookup (stats, "pac-downloads", "u", &downloads));
+  g_assert_cmpuint (downloads, ==, 0);
+
+  /* The compiled PAC is cached next to it */
+  dir = g_dir_open (cache_dir, 0, NULL);
+  g_assert_nonnull (dir);
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    if (g_str_has_suffix (name, ".dukbc"))
+      bytecode_files++;
+  }
+  g_assert_cmpuint (bytecode_files, ==, 1);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_disk_cache (Fixture    *self,
+                             const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_disk_cache, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_timeout (gpointer data)
+{
+  Fixture *self = data;
+  g_autofree char *path = g_test_build_filename (G_TEST_DIST, "data", "px-manager-pac-timeout", NULL);
+  g_autoptr (PxManager) manager = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_auto (GStrv) config = NULL;
+  guint timeouts = 0;
+
+  manager = px_manager_new_with_options ("config-plugin", "config-sysconfig",
+                                         "config-option", path,
+                                         "force-online", TRUE,
+                                         "pac-timeout", 100,
+                                         NULL);
+
+  /* A PAC which never returns is treated as returning DIRECT */
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+
+  /* The fallback is not cached, so the PAC runs again */
+  g_clear_pointer (&config, g_strfreev);
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+
+  stats = g_variant_ref_sink (px_manager_get_stats (manager));
+  g_assert_true (g_variant_lookup (stats, "pac-timeouts", "u", &timeouts));
+  g_assert_cmpuint (timeouts, ==, 2);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_timeout (Fixture    *self,
+                          const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_timeout, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_memory_limit (gpointer data)
+{
+  Fixture *self = data;
+  g_autofree char *path = g_test_build_filename (G_TEST_DIST, "data", "px-manager-pac-memory", NULL);
+  g_autoptr (PxManager) manager = NULL;
+  g_autoptr (GVariant) stats = NULL;
+  g_auto (GStrv) config = NULL;
+  guint64 limit = 1024 * 1024;
+  guint64 used = 0;
+  guint64 peak = 0;
+  guint timeouts = 0;
+
+  manager = px_manager_new_with_options ("config-plugin", "config-sysconfig",
+                                         "config-option", path,
+                                         "force-online", TRUE,
+                                         "pac-pool-size", 1,
+                                         "pac-memory-limit", limit,
+                                         NULL);
+
+  /* A PAC which runs out of memory is treated as returning DIRECT */
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+
+  stats = g_variant_ref_sink (px_manager_get_stats (manager));
+  g_assert_true (g_variant_lookup (stats, "pac-timeouts", "u", &timeouts));
+  g_assert_cmpuint (timeouts, ==, 0);
+  g_assert_true (g_variant_lookup (stats, "pac-memory-used", "t", &used));
+  g_assert_true (g_variant_lookup (stats, "pac-memory-peak", "t", &peak));
+  g_assert_cmpuint (peak, >, 0);
+  g_assert_cmpuint (peak, <=, limit);
+  g_assert_cmpuint (used, <=, peak);
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_memory_limit (Fixture    *self,
+                               const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_memory_limit, self);
+  g_main_loop_run (self->loop);
+}
+
+static gpointer
+get_proxies_pac_url (gpointer data)
+{
+  Fixture *self = data;
+  g_autofree char *path = g_test_build_filename (G_TEST_DIST, "data", "px-manager-pac-url", NULL);
+  g_autoptr (PxManager) manager = NULL;
+  g_auto (GStrv) config = NULL;
+
+  manager = px_manager_new_with_options ("config-plugin", "config-sysconfig",
+                                         "config-option", path,
+                                         "force-online", TRUE,
+                                         "pac-url", PX_MANAGER_PAC_URL_STRIP_HTTPS,
+                                         NULL);
+
+  /* Path and query of https urls are hidden from the PAC */
+  config = px_manager_get_proxies_sync (manager, "https://www.example.com/private?q=1");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "direct://");
+  g_clear_pointer (&config, g_strfreev);
+
+  config = px_manager_get_proxies_sync (manager, "http://www.example.com/private?q=1");
+  g_assert_nonnull (config);
+  g_assert_cmpstr (config[0], ==, "http://127.0.0.1:1984");
+
+  g_main_loop_quit (self->loop);
+
+  return NULL;
+}
+
+static void
+test_get_proxies_pac_url (Fixture    *self,
+                          const void *user_data)
+{
+  g_autoptr (GThread) thread = NULL;
+
+  thread = g_thread_new ("test", (GThreadFunc)get_proxies_pac_url, self);
+  g_main_loop_run (self->loop);
+}
+
 static void
 test_ignore_domain (Fixture    *self,
                     const void *user_data)
@@ -418,7 +1006,8 @@ main (int    argc,
   g_autoptr (GSocketService) service = NULL;
   g_autoptr (GError) error = NULL;
 
-  g_test_init (&argc, &argv, NULL);
+  /* Keep the disk cache out of the user's home directory */
+  g_test_init (&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
 
   service = g_socket_service_new ();
   if (!g_socket_listener_add_inet_port (G_SOCKET_LISTENER (service), SERVER_PORT, NULL, &error)) {
@@ -432,7 +1021,19 @@ main (int    argc,
   g_test_add ("/pac/get_proxies_direct", Fixture, "px-manager-direct", fixture_setup, test_get_proxies_direct, fixture_teardown);
   g_test_add ("/pac/get_proxies_nonpac", Fixture, "px-manager-nonpac", fixture_setup, test_get_proxies_nonpac, fixture_teardown);
   g_test_add ("/pac/get_proxies_pac", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_pac, fixture_teardown);
+  g_test_add ("/pac/get_proxies_cached", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_cached, fixture_teardown);
+  g_test_add ("/pac/get_proxies_concurrent", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_concurrent, fixture_teardown);
+  g_test_add ("/pac/get_proxies_batch", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_batch, fixture_teardown);
+  g_test_add ("/pac/get_proxies_async", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_async, fixture_teardown);
+  g_test_add ("/pac/get_proxies_async_cancelled", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_async_cancelled, fixture_teardown);
+  g_test_add ("/pac/get_proxies_revalidate", Fixture, "px-manager-pac-revalidate", fixture_setup, test_get_proxies_revalidate, fixture_teardown);
+  g_test_add ("/pac/get_proxies_slots", Fixture, "px-manager-pac-slots", fixture_setup, test_get_proxies_slots, fixture_teardown);
+  g_test_add ("/pac/get_proxies_disk_cache", Fixture, NULL, fixture_setup, test_get_proxies_disk_cache, fixture_teardown);
+  g_test_add ("/pac/get_proxies_timeout", Fixture, NULL, fixture_setup, test_get_proxies_timeout, fixture_teardown);
+  g_test_add ("/pac/get_proxies_memory_limit", Fixture, NULL, fixture_setup, test_get_proxies_memory_limit, fixture_teardown);
+  g_test_add ("/pac/get_proxies_pac_url", Fixture, NULL, fixture_setup, test_get_proxies_pac_url, fixture_teardown);
   g_test_add ("/pac/wpad", Fixture, "px-manager-wpad", fixture_setup, test_get_wpad, fixture_teardown);
+  g_test_add ("/pac/wpad_backoff", Fixture, "px-manager-wpad", fixture_setup, test_get_wpad_backoff, fixture_teardown);
   g_test_add ("/pac/get_proxies_pac_debug", Fixture, "px-manager-pac", fixture_setup, test_get_proxies_pac_debug, fixture_teardown);
 
   g_test_add ("/ignore/domain", Fixture, "px-manager-ignore", fixture_setup, test_ignore_domain, fixture_teardown);